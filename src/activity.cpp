@@ -0,0 +1,102 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(OS_LINUX)
+#include <sys/sysmacros.h>
+#endif
+
+#include "activity.h"
+
+namespace stenc {
+
+static std::optional<std::uint64_t> read_counter(const std::string& path)
+{
+  std::ifstream in {path};
+  std::uint64_t value;
+  if (!(in >> value)) {
+    return {};
+  }
+  return value;
+}
+
+std::optional<io_counters> read_io_counters(const std::string& stats_dir)
+{
+  auto read_cnt {read_counter(stats_dir + "/read_cnt")};
+  auto write_cnt {read_counter(stats_dir + "/write_cnt")};
+  auto other_cnt {read_counter(stats_dir + "/other_cnt")};
+  auto in_flight {read_counter(stats_dir + "/in_flight")};
+  if (!read_cnt || !write_cnt || !other_cnt || !in_flight) {
+    return {};
+  }
+  return io_counters {*read_cnt, *write_cnt, *other_cnt, *in_flight};
+}
+
+std::string stats_dir_of(const std::string& device)
+{
+#if defined(OS_LINUX)
+  struct stat st {};
+  if (stat(device.c_str(), &st) != 0 || !S_ISCHR(st.st_mode)) {
+    return {};
+  }
+
+  // every node of the drive links to the SCSI device, which lists the st
+  // nodes registered for it
+  std::ostringstream dir;
+  dir << "/sys/dev/char/" << major(st.st_rdev) << ':' << minor(st.st_rdev)
+      << "/device/scsi_tape";
+  struct dir_closer {
+    void operator()(DIR *d) const noexcept { closedir(d); }
+  };
+  std::unique_ptr<DIR, dir_closer> d {opendir(dir.str().c_str())};
+  if (d == nullptr) {
+    return {};
+  }
+  while (auto entry {readdir(d.get())}) {
+    std::string name {entry->d_name};
+    // st0, not nst0 or the mode variants st0l, st0m, st0a
+    if (name.size() > 2 && name.compare(0, 2, "st") == 0 &&
+        name.find_first_not_of("0123456789", 2) == std::string::npos) {
+      return "/sys/class/scsi_tape/" + name + "/stats";
+    }
+  }
+#endif
+  return {};
+}
+
+bool is_drive_busy(const std::string& device,
+                   std::chrono::milliseconds interval)
+{
+  auto dir {stats_dir_of(device)};
+  if (dir.empty()) {
+    return false;
+  }
+  auto before {read_io_counters(dir)};
+  if (!before) {
+    return false;
+  }
+  if (before->in_flight > 0u) {
+    return true;
+  }
+  // between two commands of a stream nothing may be outstanding, but the
+  // counters keep moving
+  std::this_thread::sleep_for(interval);
+  auto after {read_io_counters(dir)};
+  return after && (after->in_flight > 0u ||
+                   after->read_cnt != before->read_cnt ||
+                   after->write_cnt != before->write_cnt ||
+                   after->other_cnt != before->other_cnt);
+}
+
+} // namespace stenc
@@ -0,0 +1,47 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+Detection of drives that are busy with I/O, from statistics kept by the
+operating system's tape driver, so that no command has to be sent to the
+drive to find out
+*/
+
+#ifndef _ACTIVITY_H
+#define _ACTIVITY_H
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace stenc {
+
+// Cumulative I/O counters of the st driver
+struct io_counters {
+  std::uint64_t read_cnt;
+  std::uint64_t write_cnt;
+  std::uint64_t other_cnt;
+  std::uint64_t in_flight; // commands currently outstanding
+};
+
+// Read the counters in an st statistics directory, e.g.
+// /sys/class/scsi_tape/st0/stats
+std::optional<io_counters> read_io_counters(const std::string& stats_dir);
+
+// Return the st statistics directory of the drive behind device, which may
+// be any of its st, nst or sg nodes. Empty if there is none, e.g. when the
+// st driver is not loaded or not on Linux.
+std::string stats_dir_of(const std::string& device);
+
+// Whether the drive behind device is doing I/O: it has commands
+// outstanding, or its counters advance within interval. Drives without
+// statistics are taken to be idle.
+bool is_drive_busy(const std::string& device,
+                   std::chrono::milliseconds interval =
+                       std::chrono::milliseconds {50});
+
+} // namespace stenc
+
+#endif
@@ -0,0 +1,161 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(OS_LINUX)
+#include <sys/sysmacros.h>
+#endif
+
+#include "devlock.h"
+#include "scsiencrypt.h"
+
+namespace stenc {
+
+static std::string sanitized(std::string key, std::size_t from)
+{
+  std::replace_if(
+      key.begin() + from, key.end(),
+      [](unsigned char c) { return !std::isalnum(c); }, '_');
+  return key;
+}
+
+std::string device_lock_key(const std::string& device)
+{
+  struct stat st {};
+
+  if (stat(device.c_str(), &st) == 0 && S_ISCHR(st.st_mode)) {
+#if defined(OS_LINUX)
+    // st, nst and sg nodes of one drive all link to the same SCSI device,
+    // whose sysfs name is its host:channel:target:lun address
+    std::ostringstream link;
+    link << "/sys/dev/char/" << major(st.st_rdev) << ':' << minor(st.st_rdev)
+         << "/device";
+    char resolved[PATH_MAX];
+    if (realpath(link.str().c_str(), resolved) != nullptr) {
+      std::string path {resolved};
+      // a drive reached over several paths has one SCSI device per path,
+      // which the kernel's copy of its identification VPD page ties together
+      std::ifstream vpd {path + "/vpd_pg83", std::ios::binary};
+      std::vector<std::uint8_t> page {std::istreambuf_iterator<char> {vpd},
+                                      std::istreambuf_iterator<char> {}};
+      auto designator {scsi::logical_unit_designator(page.data(), page.size())};
+      if (!designator.empty()) {
+        return sanitized("lu-" + designator, 3);
+      }
+      return "scsi-" + path.substr(path.find_last_of('/') + 1);
+    }
+#endif
+    std::ostringstream oss;
+    oss << "dev-" << major(st.st_rdev) << '-' << minor(st.st_rdev);
+    return oss.str();
+  }
+
+  return sanitized("path-" + device, 5);
+}
+
+// Whether a file or directory belongs to root or to this process, so that
+// no other user can have planted or be able to replace it
+static bool trusted_owner(const struct stat& st)
+{
+  return st.st_uid == 0 || st.st_uid == geteuid();
+}
+
+device_lock::device_lock(const std::string& device, lock_mode mode,
+                         std::chrono::milliseconds timeout,
+                         const std::string& lock_dir)
+{
+  const auto path {lock_dir + "/stenc-" + device_lock_key(device) + ".lock"};
+
+  // Only root, or the user owning the directory, may create lock files in
+  // it. In a directory writable by others, anyone could hold a lock file
+  // of their own making, or link it elsewhere.
+  if (mkdir(lock_dir.c_str(), 0755) && errno != EEXIST) {
+    if (errno == EACCES || errno == EROFS || errno == ENOENT) {
+      return; // caller decides whether to go on without the lock
+    }
+    throw std::system_error {errno, std::generic_category(),
+                             "Cannot create lock directory " + lock_dir};
+  }
+  struct stat dir_st {};
+  if (lstat(lock_dir.c_str(), &dir_st) || !S_ISDIR(dir_st.st_mode) ||
+      !trusted_owner(dir_st) || (dir_st.st_mode & (S_IWGRP | S_IWOTH))) {
+    return;
+  }
+
+  // flock needs no write access, so users other than the one who created
+  // the file can take the lock too
+  fd = open(path.c_str(),
+            O_RDONLY | O_CREAT | O_NOFOLLOW | O_NOCTTY | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    if (errno == EACCES || errno == EROFS || errno == ENOENT) {
+      return;
+    }
+    throw std::system_error {errno, std::generic_category(),
+                             "Cannot open lock file " + path};
+  }
+  struct stat st {};
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !trusted_owner(st)) {
+    close(fd);
+    fd = -1;
+    throw std::runtime_error {"Refusing to use lock file " + path +
+                              ", which is not a regular file owned by root"};
+  }
+  if (st.st_uid == geteuid()) {
+    // not restricted by the umask
+    fchmod(fd, 0644);
+  }
+
+  const int op {(mode == lock_mode::shared ? LOCK_SH : LOCK_EX) | LOCK_NB};
+  const auto deadline {std::chrono::steady_clock::now() + timeout};
+  std::chrono::milliseconds delay {5};
+
+  while (flock(fd, op)) {
+    if (errno == EINTR) {
+      continue;
+    }
+    const auto err {errno};
+    const auto now {std::chrono::steady_clock::now()};
+    if (err != EWOULDBLOCK || now >= deadline) {
+      close(fd);
+      fd = -1;
+      if (err != EWOULDBLOCK) {
+        throw std::system_error {err, std::generic_category(),
+                                 "Cannot lock " + path};
+      }
+      throw std::runtime_error {"Timed out waiting for lock on " + device};
+    }
+    std::this_thread::sleep_for(
+        std::min<std::chrono::steady_clock::duration>(delay, deadline - now));
+    delay = std::min(delay * 2, std::chrono::milliseconds {200});
+  }
+}
+
+device_lock::~device_lock()
+{
+  if (fd != -1) {
+    close(fd); // releases the flock
+  }
+}
+
+} // namespace stenc
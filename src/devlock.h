@@ -0,0 +1,50 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+Advisory per-drive locking so that concurrent stenc invocations on the same
+drive are serialized instead of interleaving their SCSI commands.
+*/
+
+#ifndef _DEVLOCK_H
+#define _DEVLOCK_H
+
+#include <chrono>
+#include <string>
+
+namespace stenc {
+
+enum class lock_mode {
+  shared,    // status queries
+  exclusive, // encryption setting changes
+};
+
+// Return a string identifying the physical drive behind device, so that all
+// device nodes of one drive (st, nst, sg), over all of its paths, map to the
+// same lock.
+std::string device_lock_key(const std::string& device);
+
+// Holds an flock(2) on a lock file named after device_lock_key() for its
+// lifetime. Waits up to timeout for conflicting holders to release the lock
+// and throws std::runtime_error if they do not.
+class device_lock {
+public:
+  device_lock(const std::string& device, lock_mode mode,
+              std::chrono::milliseconds timeout,
+              const std::string& lock_dir = LOCK_DIR);
+  ~device_lock();
+  device_lock(const device_lock&) = delete;
+  device_lock& operator=(const device_lock&) = delete;
+
+  // false if the lock file could not be created, or the lock directory is
+  // writable by other users, and the lock is not held
+  bool held() const noexcept { return fd != -1; }
+
+private:
+  int fd {-1};
+};
+
+} // namespace stenc
+
+#endif
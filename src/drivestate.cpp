@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <string>
+
+#include "drivestate.h"
+
+namespace stenc {
+
+// inquiry strings are space padded to their fixed width
+static std::string trimmed(const char *s, std::size_t length)
+{
+  while (length > 0 && (s[length - 1] == ' ' || s[length - 1] == '\0')) {
+    length--;
+  }
+  return {s, length};
+}
+
+const char *to_string(volume_state v)
+{
+  switch (v) {
+  case volume_state::no_media:
+    return "no media";
+  case volume_state::not_at_block:
+    return "not at block";
+  case volume_state::not_encrypted:
+    return "not encrypted";
+  case volume_state::encrypted:
+    return "encrypted";
+  case volume_state::encrypted_nokey:
+    return "encrypted, no key";
+  case volume_state::busy:
+    return "busy";
+  default:
+    return "unknown";
+  }
+}
+
+void decode_inquiry(drive_state& state, const scsi::inquiry_data& inq)
+{
+  state.vendor = trimmed(inq.vendor, sizeof(inq.vendor));
+  state.product = trimmed(inq.product_id, sizeof(inq.product_id));
+  state.revision = trimmed(inq.product_rev, sizeof(inq.product_rev));
+}
+
+void decode_des(drive_state& state, const scsi::page_des& page)
+{
+  state.des_valid = true;
+  state.encryption_mode = page.encryption_mode;
+  state.decryption_mode = page.decryption_mode;
+  state.algorithm_index = page.algorithm_index;
+  state.key_instance_counter = ntohl(page.key_instance_counter);
+  state.scope = page.it_nexus_scope();
+  state.ukad.clear();
+  for (const scsi::kad& kd: scsi::read_page_kads(page)) {
+    if (kd.type == scsi::kad_type::ukad) {
+      state.ukad.assign(reinterpret_cast<const char *>(kd.descriptor),
+                        ntohs(kd.length));
+    }
+  }
+}
+
+void decode_nbes(drive_state& state, const scsi::page_nbes& page)
+{
+  auto encryption_status {static_cast<unsigned int>(
+      page.status & scsi::page_nbes::status_encryption_mask)};
+
+  switch (encryption_status) {
+  case 2u << scsi::page_nbes::status_encryption_pos:
+    state.volume = volume_state::not_at_block;
+    break;
+  case 3u << scsi::page_nbes::status_encryption_pos:
+    state.volume = volume_state::not_encrypted;
+    break;
+  case 5u << scsi::page_nbes::status_encryption_pos:
+    state.volume = volume_state::encrypted;
+    break;
+  case 6u << scsi::page_nbes::status_encryption_pos:
+    state.volume = volume_state::encrypted_nokey;
+    break;
+  default:
+    state.volume = volume_state::unknown;
+    break;
+  }
+}
+
+} // namespace stenc
@@ -0,0 +1,63 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+Decoded encryption state of a drive, for compact reporting of many drives
+*/
+
+#ifndef _DRIVESTATE_H
+#define _DRIVESTATE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "scsiencrypt.h"
+
+namespace stenc {
+
+enum class volume_state : std::uint8_t {
+  unknown,         // not queried, or drive cannot determine
+  no_media,        // no tape loaded
+  not_at_block,    // tape position not at a logical block
+  not_encrypted,   // next block is not encrypted
+  encrypted,       // next block is encrypted and can be decrypted
+  encrypted_nokey, // next block is encrypted with a key the drive lacks
+  busy             // not queried while the drive is busy with I/O
+};
+
+const char *to_string(volume_state v);
+
+struct drive_state {
+  std::string device;
+  std::string vendor;
+  std::string product;
+  std::string revision;
+
+  bool des_valid {};
+  scsi::encrypt_mode encryption_mode {};
+  scsi::decrypt_mode decryption_mode {};
+  std::uint8_t algorithm_index {};
+  std::uint32_t key_instance_counter {};
+  std::string ukad;
+  scsi::nexus_scope scope {};
+
+  volume_state volume {volume_state::unknown};
+
+  // time taken by the SCSI commands that produced this state
+  std::chrono::microseconds latency {};
+  // last error, empty if the drive answered all queries
+  std::string error;
+};
+
+// Fill in identity fields from standard inquiry data
+void decode_inquiry(drive_state& state, const scsi::inquiry_data& inq);
+// Fill in drive encryption settings from a device encryption status page
+void decode_des(drive_state& state, const scsi::page_des& page);
+// Fill in volume encryption status from a next block encryption status page
+void decode_nbes(drive_state& state, const scsi::page_nbes& page);
+
+} // namespace stenc
+
+#endif
@@ -0,0 +1,128 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <sstream>
+#include <string_view>
+
+#include "events.h"
+
+namespace stenc {
+
+const char *to_string(event_type t)
+{
+  switch (t) {
+  case event_type::des:
+    return "des";
+  case event_type::kic:
+    return "kic";
+  case event_type::media:
+    return "media";
+  case event_type::volume:
+    return "volume";
+  case event_type::health:
+    return "health";
+  default:
+    return "unknown";
+  }
+}
+
+// settings in the syntax of --check
+static std::string describe_settings(const drive_state& state)
+{
+  std::ostringstream oss;
+  oss << "enc=" << state.encryption_mode << ",dec=" << state.decryption_mode
+      << ",alg=" << static_cast<unsigned int>(state.algorithm_index);
+  if (!state.ukad.empty()) {
+    oss << ",ukad=" << state.ukad;
+  }
+  if (state.scope == scsi::nexus_scope::local) {
+    oss << ",scope=local";
+  }
+  return oss.str();
+}
+
+std::vector<drive_event> diff_states(const drive_state& before,
+                                     const drive_state& after)
+{
+  std::vector<drive_event> events;
+  auto add {[&](event_type type, std::string detail) {
+    events.push_back({after.device, type, std::move(detail)});
+  }};
+
+  if (before.error.empty() != after.error.empty()) {
+    add(event_type::health,
+        after.error.empty() ? "ok" : "error: " + after.error);
+  }
+  if (!after.error.empty()) {
+    return events;
+  }
+
+  if (before.des_valid && after.des_valid) {
+    if (before.encryption_mode != after.encryption_mode ||
+        before.decryption_mode != after.decryption_mode ||
+        before.algorithm_index != after.algorithm_index ||
+        before.ukad != after.ukad || before.scope != after.scope) {
+      add(event_type::des, describe_settings(after));
+    }
+    if (before.key_instance_counter != after.key_instance_counter) {
+      add(event_type::kic, std::to_string(after.key_instance_counter));
+    }
+  }
+
+  // the volume of a busy drive was not queried
+  if (before.volume != volume_state::busy &&
+      after.volume != volume_state::busy && before.error.empty()) {
+    const bool was_loaded {before.volume != volume_state::no_media};
+    const bool is_loaded {after.volume != volume_state::no_media};
+    if (was_loaded != is_loaded) {
+      add(event_type::media, is_loaded ? "loaded" : "removed");
+    }
+    if (is_loaded && before.volume != after.volume) {
+      add(event_type::volume, to_string(after.volume));
+    }
+  }
+  return events;
+}
+
+std::optional<event_mask> parse_event_mask(const std::string& list)
+{
+  event_mask mask {};
+  std::string_view rest {list};
+
+  while (!rest.empty()) {
+    auto comma {rest.find(',')};
+    auto name {rest.substr(0, comma)};
+    rest = comma == rest.npos ? std::string_view {} : rest.substr(comma + 1);
+
+    bool found {};
+    for (auto t: {event_type::des, event_type::kic, event_type::media,
+                  event_type::volume, event_type::health}) {
+      if (name == to_string(t)) {
+        mask |= mask_of(t);
+        found = true;
+      }
+    }
+    if (!found) {
+      return {};
+    }
+  }
+  if (mask == 0u) {
+    return {};
+  }
+  return mask;
+}
+
+void print_event(std::ostream& os, const drive_event& event, std::time_t time)
+{
+  std::tm tm {};
+  char timestamp[32];
+  gmtime_r(&time, &tm);
+  std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+  os << timestamp << ' ' << event.device << ' ' << to_string(event.type)
+     << ' ' << event.detail << '\n';
+}
+
+} // namespace stenc
@@ -0,0 +1,62 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+Events derived from successive states of a drive, for reporting changes to
+drives as they happen rather than their full state
+*/
+
+#ifndef _EVENTS_H
+#define _EVENTS_H
+
+#include <cstdint>
+#include <ctime>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "drivestate.h"
+
+namespace stenc {
+
+enum class event_type : std::uint8_t {
+  des,    // encryption settings changed
+  kic,    // key instance counter advanced
+  media,  // media loaded or removed
+  volume, // encryption status of the next block changed
+  health, // drive stopped or started answering queries
+};
+
+const char *to_string(event_type t);
+
+// Set of event types, one bit per type
+using event_mask = std::uint8_t;
+
+constexpr event_mask mask_of(event_type t)
+{
+  return static_cast<event_mask>(1u << static_cast<unsigned int>(t));
+}
+constexpr event_mask all_events {0x1fu};
+
+struct drive_event {
+  std::string device;
+  event_type type;
+  std::string detail;
+};
+
+// Events for the changes between two states of the same drive. Fields that
+// could not be queried in either state are not compared.
+std::vector<drive_event> diff_states(const drive_state& before,
+                                     const drive_state& after);
+
+// Parse a comma-separated list of event type names
+std::optional<event_mask> parse_event_mask(const std::string& list);
+
+// Print an event as one line: time (UTC), device, type and detail
+void print_event(std::ostream& os, const drive_event& event, std::time_t time);
+
+} // namespace stenc
+
+#endif
@@ -0,0 +1,132 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <string_view>
+
+#include "fleet.h"
+
+namespace stenc {
+
+std::optional<fleet_query> parse_fleet_query(const std::string& spec)
+{
+  fleet_query query;
+  std::string expectation;
+  std::string_view rest {spec};
+
+  while (!rest.empty()) {
+    auto comma {rest.find(',')};
+    auto item {rest.substr(0, comma)};
+    rest = comma == rest.npos ? std::string_view {} : rest.substr(comma + 1);
+
+    if (item == "health=ok") {
+      query.healthy = true;
+    } else if (item == "health=error") {
+      query.healthy = false;
+    } else {
+      if (!expectation.empty()) {
+        expectation += ',';
+      }
+      expectation += item;
+    }
+  }
+  if (!expectation.empty()) {
+    auto state {parse_expectation(expectation)};
+    if (!state) {
+      return {};
+    }
+    query.state = *state;
+  }
+  return query;
+}
+
+fleet_state::fleet_state(const std::vector<drive_state>& states)
+{
+  const auto n {states.size()};
+  des_valid.reserve(n);
+  enc.reserve(n);
+  dec.reserve(n);
+  alg.reserve(n);
+  scope.reserve(n);
+  loaded.reserve(n);
+  healthy.reserve(n);
+  ukad.reserve(n);
+  for (const auto& state: states) {
+    des_valid.push_back(state.des_valid);
+    enc.push_back(state.encryption_mode);
+    dec.push_back(state.decryption_mode);
+    alg.push_back(state.algorithm_index);
+    scope.push_back(state.scope);
+    loaded.push_back(state.volume != volume_state::no_media &&
+                     state.volume != volume_state::unknown);
+    healthy.push_back(state.error.empty());
+    ukad.push_back(state.ukad);
+  }
+}
+
+// Clear the entries of match whose column value differs from value. Kept
+// branch-free over contiguous arrays so that the compiler can vectorize it.
+template <typename T>
+static void filter(std::vector<std::uint8_t>& match,
+                   const std::vector<T>& column, T value)
+{
+  const auto n {match.size()};
+  for (std::size_t i = 0; i < n; i++) {
+    match[i] &= static_cast<std::uint8_t>(column[i] == value);
+  }
+}
+
+// drives with fixed length key descriptors return them space padded
+static std::string_view without_padding(std::string_view s)
+{
+  auto end {s.find_last_not_of(' ')};
+  return end == s.npos ? std::string_view {} : s.substr(0, end + 1);
+}
+
+std::vector<std::size_t> fleet_state::select(const fleet_query& query) const
+{
+  const auto& state {query.state};
+  std::vector<std::uint8_t> match(size(), 1u);
+
+  if (state.enc_mode || state.dec_mode || state.algorithm_index ||
+      state.scope || state.key_name) {
+    filter(match, des_valid, std::uint8_t {1u});
+  }
+  if (state.enc_mode) {
+    filter(match, enc, *state.enc_mode);
+  }
+  if (state.dec_mode) {
+    filter(match, dec, *state.dec_mode);
+  }
+  if (state.algorithm_index) {
+    filter(match, alg, *state.algorithm_index);
+  }
+  if (state.scope) {
+    filter(match, scope, *state.scope);
+  }
+  if (state.media_loaded) {
+    filter(match, loaded, std::uint8_t {*state.media_loaded});
+  }
+  if (query.healthy) {
+    filter(match, healthy, std::uint8_t {*query.healthy});
+  }
+  if (state.key_name) {
+    const auto expected {without_padding(*state.key_name)};
+    for (std::size_t i = 0; i < match.size(); i++) {
+      match[i] &= static_cast<std::uint8_t>(
+          match[i] && without_padding(ukad[i]) == expected);
+    }
+  }
+
+  std::vector<std::size_t> selected;
+  for (std::size_t i = 0; i < match.size(); i++) {
+    if (match[i]) {
+      selected.push_back(i);
+    }
+  }
+  return selected;
+}
+
+} // namespace stenc
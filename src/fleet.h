@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+Decoded state of many drives stored column by column, so that selecting
+drives by their state scans a few contiguous arrays instead of every
+drive_state
+*/
+
+#ifndef _FLEET_H
+#define _FLEET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "drivestate.h"
+#include "operations.h"
+
+namespace stenc {
+
+// Drives to select; unset fields select all drives
+struct fleet_query {
+  // enc, dec, alg, ukad, scope and media as for --check
+  drive_expectation state;
+  // whether the drive answered all queries
+  std::optional<bool> healthy;
+};
+
+// Parse a comma-separated list of KEY=VALUE pairs, where KEY is one of the
+// keys of parse_expectation or health (ok or error)
+std::optional<fleet_query> parse_fleet_query(const std::string& spec);
+
+class fleet_state {
+public:
+  explicit fleet_state(const std::vector<drive_state>& states);
+
+  std::size_t size() const noexcept { return enc.size(); }
+  // Indexes of the drives matching query, in increasing order
+  std::vector<std::size_t> select(const fleet_query& query) const;
+
+private:
+  std::vector<std::uint8_t> des_valid;
+  std::vector<scsi::encrypt_mode> enc;
+  std::vector<scsi::decrypt_mode> dec;
+  std::vector<std::uint8_t> alg;
+  std::vector<scsi::nexus_scope> scope;
+  std::vector<std::uint8_t> loaded;
+  std::vector<std::uint8_t> healthy;
+  std::vector<std::string> ukad;
+};
+
+} // namespace stenc
+
+#endif
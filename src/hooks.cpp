@@ -0,0 +1,144 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <future>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+#include <dlfcn.h>
+
+#include "hooks.h"
+
+namespace stenc {
+
+// Copy of the arguments of one hook call, shared with the worker thread so
+// that they stay valid if the call is abandoned
+struct hook_call {
+  drive_state before;
+  drive_state after;
+  std::string key_name;
+  stenc_hook_drive c_before {};
+  stenc_hook_drive c_after {};
+  stenc_hook_change change {};
+
+  hook_call(const drive_state& before, const drive_state *after,
+            const std::string& key_name)
+      : before {before}, after {after ? *after : drive_state {}},
+        key_name {key_name}
+  {
+    change.api_version = STENC_HOOK_API_VERSION;
+    change.key_descriptor = this->key_name.c_str();
+    to_c(this->before, c_before);
+    change.before = &c_before;
+    if (after != nullptr) {
+      to_c(this->after, c_after);
+      change.after = &c_after;
+    }
+  }
+
+  static void to_c(const drive_state& state, stenc_hook_drive& c)
+  {
+    c.device = state.device.c_str();
+    c.vendor = state.vendor.c_str();
+    c.product = state.product.c_str();
+    c.revision = state.revision.c_str();
+    c.des_valid = state.des_valid;
+    c.encryption_mode = static_cast<int>(state.encryption_mode);
+    c.decryption_mode = static_cast<int>(state.decryption_mode);
+    c.algorithm_index = state.algorithm_index;
+    c.key_instance_counter = state.key_instance_counter;
+    c.key_descriptor = state.ukad.c_str();
+    c.key_scope = static_cast<int>(state.scope);
+  }
+};
+
+// Run fn on a detached thread and wait at most timeout for its result
+template <typename Function>
+static std::optional<int> run_with_timeout(Function fn,
+                                           std::chrono::milliseconds timeout)
+{
+  auto task {std::make_shared<std::packaged_task<int()>>(std::move(fn))};
+  auto result {task->get_future()};
+  std::thread {[task] { (*task)(); }}.detach();
+  if (result.wait_for(timeout) == std::future_status::timeout) {
+    return {};
+  }
+  return result.get();
+}
+
+hook_functions load_hooks(const std::string& path)
+{
+  auto handle {dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL)};
+  if (handle == nullptr) {
+    throw std::runtime_error {dlerror()};
+  }
+
+  auto version {static_cast<const unsigned int *>(
+      dlsym(handle, "stenc_hook_api_version"))};
+  if (version != nullptr && *version != STENC_HOOK_API_VERSION) {
+    dlclose(handle);
+    throw std::runtime_error {"Hook library " + path +
+                              " was built for another version of stenc"};
+  }
+
+  hook_functions functions {
+      reinterpret_cast<stenc_hook_pre_change_fn>(
+          dlsym(handle, "stenc_hook_pre_change")),
+      reinterpret_cast<stenc_hook_post_change_fn>(
+          dlsym(handle, "stenc_hook_post_change")),
+  };
+  if (functions.pre_change == nullptr && functions.post_change == nullptr) {
+    dlclose(handle);
+    throw std::runtime_error {"Hook library " + path +
+                              " does not export any hooks"};
+  }
+  return functions;
+}
+
+change_hooks make_change_hooks(const hook_functions& functions,
+                               std::chrono::milliseconds timeout)
+{
+  change_hooks hooks;
+
+  if (auto pre {functions.pre_change}) {
+    hooks.pre = [pre, timeout](const drive_state& before,
+                               const std::string& key_name,
+                               std::ostream& err) {
+      auto call {std::make_shared<hook_call>(before, nullptr, key_name)};
+      auto result {run_with_timeout([pre, call] { return pre(&call->change); },
+                                    timeout)};
+      if (!result) {
+        err << "stenc: Pre-change hook timed out for " << before.device
+            << '\n';
+        return false;
+      }
+      return *result == 0;
+    };
+  }
+  if (auto post {functions.post_change}) {
+    hooks.post = [post, timeout](const drive_state& before,
+                                 const drive_state& after,
+                                 const std::string& key_name,
+                                 std::ostream& err) {
+      auto call {std::make_shared<hook_call>(before, &after, key_name)};
+      auto result {run_with_timeout(
+          [post, call] {
+            post(&call->change);
+            return 0;
+          },
+          timeout)};
+      if (!result) {
+        err << "stenc: Post-change hook timed out for " << before.device
+            << '\n';
+      }
+    };
+  }
+  return hooks;
+}
+
+} // namespace stenc
@@ -0,0 +1,40 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+In-process hooks around key changes, loaded from a shared library that
+implements the interface in stenc_hook.h
+*/
+
+#ifndef _HOOKS_H
+#define _HOOKS_H
+
+#include <chrono>
+#include <string>
+
+#include "operations.h"
+#include "stenc_hook.h"
+
+namespace stenc {
+
+// Entry points of a hook library; either may be null
+struct hook_functions {
+  stenc_hook_pre_change_fn pre_change;
+  stenc_hook_post_change_fn post_change;
+};
+
+// Load a hook library with dlopen. The library stays loaded for the
+// lifetime of the process. Throws std::runtime_error if it cannot be
+// loaded, exports neither hook, or was built for another API version.
+hook_functions load_hooks(const std::string& path);
+
+// Adapt hook functions to change_hooks. Each call runs on its own thread
+// and is abandoned after timeout; an abandoned pre-change hook cancels the
+// change.
+change_hooks make_change_hooks(const hook_functions& functions,
+                               std::chrono::milliseconds timeout);
+
+} // namespace stenc
+
+#endif
@@ -0,0 +1,126 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include <strings.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "keyarena.h"
+
+namespace stenc {
+
+void secure_wipe(void *p, std::size_t length) noexcept
+{
+#if defined(HAVE_EXPLICIT_BZERO)
+  explicit_bzero(p, length);
+#else
+  auto vp {static_cast<volatile std::uint8_t *>(p)};
+  while (length--) {
+    *vp++ = 0u;
+  }
+#endif
+}
+
+key_slot::key_slot(key_slot&& other) noexcept
+    : arena {other.arena}, p {other.p}, length {other.length}
+{
+  other.arena = nullptr;
+  other.p = nullptr;
+  other.length = 0u;
+}
+
+key_slot& key_slot::operator=(key_slot&& other) noexcept
+{
+  if (this != &other) {
+    release();
+    arena = other.arena;
+    p = other.p;
+    length = other.length;
+    other.arena = nullptr;
+    other.p = nullptr;
+    other.length = 0u;
+  }
+  return *this;
+}
+
+void key_slot::resize(std::size_t n)
+{
+  if (n > capacity) {
+    throw std::length_error {"Key material exceeds key slot size"};
+  }
+  length = n;
+}
+
+void key_slot::release() noexcept
+{
+  if (p != nullptr) {
+    arena->release(p);
+    arena = nullptr;
+    p = nullptr;
+    length = 0u;
+  }
+}
+
+key_arena::key_arena(std::size_t slots)
+{
+  const auto page_size {static_cast<std::size_t>(sysconf(_SC_PAGESIZE))};
+  mapped_length =
+      (slots * key_slot::capacity + page_size - 1) / page_size * page_size;
+
+  auto p {mmap(nullptr, mapped_length, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)};
+  if (p == MAP_FAILED) {
+    throw std::bad_alloc {};
+  }
+  base = static_cast<std::uint8_t *>(p);
+  // locking may fail for unprivileged users over RLIMIT_MEMLOCK, in which
+  // case the arena is still usable, only not protected from swapping
+  is_locked = mlock(base, mapped_length) == 0;
+#if defined(MADV_DONTDUMP)
+  madvise(base, mapped_length, MADV_DONTDUMP);
+#elif defined(MADV_NOCORE)
+  madvise(base, mapped_length, MADV_NOCORE);
+#endif
+
+  free_slots.reserve(slots);
+  for (std::size_t i = slots; i > 0; i--) {
+    free_slots.push_back(base + (i - 1) * key_slot::capacity);
+  }
+}
+
+key_arena::~key_arena()
+{
+  secure_wipe(base, mapped_length);
+  if (is_locked) {
+    munlock(base, mapped_length);
+  }
+  munmap(base, mapped_length);
+}
+
+key_slot key_arena::acquire()
+{
+  std::lock_guard<std::mutex> guard {mutex};
+  if (free_slots.empty()) {
+    throw std::bad_alloc {};
+  }
+  auto p {free_slots.back()};
+  free_slots.pop_back();
+  return {this, p};
+}
+
+void key_arena::release(std::uint8_t *p) noexcept
+{
+  secure_wipe(p, key_slot::capacity);
+  std::lock_guard<std::mutex> guard {mutex};
+  // never exceeds the capacity reserved in the constructor
+  free_slots.push_back(p);
+}
+
+} // namespace stenc
@@ -0,0 +1,81 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+Locked memory for key material. Keys and the pages carrying them are kept
+in fixed-size slots of a preallocated arena that is locked into memory,
+excluded from core dumps, and wiped whenever a slot is released.
+*/
+
+#ifndef _KEYARENA_H
+#define _KEYARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace stenc {
+
+// Overwrite memory in a way the compiler may not optimize away
+void secure_wipe(void *p, std::size_t length) noexcept;
+
+class key_arena;
+
+// A slot handed out by key_arena. Move-only; returns itself to the arena,
+// wiped, when destroyed.
+class key_slot {
+public:
+  static constexpr std::size_t capacity {1024u};
+
+  key_slot() = default;
+  key_slot(key_slot&& other) noexcept;
+  key_slot& operator=(key_slot&& other) noexcept;
+  ~key_slot() { release(); }
+
+  std::uint8_t *data() const noexcept { return p; }
+  // number of bytes in use
+  std::size_t size() const noexcept { return length; }
+  void resize(std::size_t n);
+  explicit operator bool() const noexcept { return p != nullptr; }
+
+  // wipe and return the slot to its arena early
+  void release() noexcept;
+
+private:
+  friend class key_arena;
+  key_slot(key_arena *arena, std::uint8_t *p) : arena {arena}, p {p} {}
+
+  key_arena *arena {};
+  std::uint8_t *p {};
+  std::size_t length {};
+};
+
+class key_arena {
+public:
+  explicit key_arena(std::size_t slots);
+  ~key_arena();
+  key_arena(const key_arena&) = delete;
+  key_arena& operator=(const key_arena&) = delete;
+
+  // Hand out a free slot; throws std::bad_alloc when all slots are in use.
+  // Does not allocate.
+  key_slot acquire();
+  // false if the operating system refused to lock the arena into memory
+  bool locked() const noexcept { return is_locked; }
+
+private:
+  friend class key_slot;
+  void release(std::uint8_t *p) noexcept;
+
+  std::uint8_t *base {};
+  std::size_t mapped_length {};
+  bool is_locked {};
+  std::mutex mutex;
+  std::vector<std::uint8_t *> free_slots;
+};
+
+} // namespace stenc
+
+#endif
@@ -20,19 +20,27 @@ GNU General Public License for more details.
 #include <config.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <charconv>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
-#include <fstream>
+#include <ctime>
 #include <iomanip>
 #include <ios>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
 #include <vector>
 
+#include <fcntl.h>
 #include <getopt.h>
 #include <sys/mtio.h>
 #include <sys/stat.h>
@@ -49,36 +57,86 @@ GNU General Public License for more details.
 #include <unistd.h>
 #endif
 
+#include "activity.h"
+#include "devlock.h"
+#include "drivestate.h"
+#include "events.h"
+#include "fleet.h"
+#include "hooks.h"
+#include "keyarena.h"
+#include "multipath.h"
+#include "operations.h"
+#include "policy.h"
+#include "quirks.h"
+#include "rotation.h"
 #include "scsiencrypt.h"
 
 using namespace std::literals::string_literals;
 
-static std::optional<std::vector<std::uint8_t>>
-key_from_hex_chars(const std::string& s)
+// Convert the hex string s of length characters into bytes stored in out,
+// which holds capacity bytes. Returns the number of bytes stored, or nothing
+// if s is not a hex string or does not fit.
+static std::optional<std::size_t> key_from_hex_chars(const char *s,
+                                                     std::size_t length,
+                                                     std::uint8_t *out,
+                                                     std::size_t capacity)
 {
-  auto it = s.data();
-  std::vector<std::uint8_t> bytes;
+  auto it = s;
+  const auto end = s + length;
+  std::size_t count {};
 
-  if (s.size() % 2) { // treated as if there is an implicit leading 0
-    std::uint8_t result;
-    auto [ptr, ec] {std::from_chars(it, it + 1, result, 16)};
+  if (length % 2) { // treated as if there is an implicit leading 0
+    if (capacity == 0u) {
+      return {};
+    }
+    auto [ptr, ec] {std::from_chars(it, it + 1, out[count], 16)};
     if (ec != std::errc {}) {
       return {};
     }
-    bytes.push_back(result);
+    count++;
     it = ptr;
   }
 
-  while (*it) {
-    std::uint8_t result;
-    auto [ptr, ec] {std::from_chars(it, it + 2, result, 16)};
+  while (it < end) {
+    if (count == capacity) {
+      return {};
+    }
+    auto [ptr, ec] {std::from_chars(it, it + 2, out[count], 16)};
     if (ec != std::errc {}) {
       return {};
     }
-    bytes.push_back(result);
+    count++;
     it = ptr;
   }
-  return bytes;
+  return count;
+}
+
+// Read a line from fd into buffer, which holds capacity bytes. Reads are
+// done directly on the file descriptor so that no stream buffer is left
+// holding a copy of key material. Returns the length of the line, or nothing
+// if it does not fit or cannot be read.
+static std::optional<std::size_t> read_line(int fd, char *buffer,
+                                            std::size_t capacity)
+{
+  std::size_t count {};
+
+  for (;;) {
+    char c;
+    auto n {read(fd, count < capacity ? &buffer[count] : &c, 1)};
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1) {
+      return {};
+    } else if (n == 0) {
+      return count;
+    }
+    if ((count < capacity ? buffer[count] : c) == '\n') {
+      return count;
+    } else if (count == capacity) {
+      return {};
+    }
+    count++;
+  }
 }
 
 // shows the command usage
@@ -88,7 +146,9 @@ static void print_usage(std::ostream& os)
 Usage: stenc [OPTION...]\n\
 \n\
 Mandatory arguments to long options are mandatory for short options too.\n\
-  -f, --file=DEVICE        use DEVICE as the tape drive to operate on\n\
+  -f, --file=DEVICE        use DEVICE as the tape drive to operate on; may be\n\
+                           given several times to operate on several drives\n\
+      --all                operate on all tape drives found on the system\n\
   -e, --encrypt=ENC-MODE   set encryption mode to ENC-MODE\n\
   -d, --decrypt=DEC-MODE   set decryption mode to DEC-MODE\n\
   -k, --key-file=FILE      read encryption key and key descriptor from FILE,\n\
@@ -99,6 +159,48 @@ Mandatory arguments to long options are mandatory for short options too.\n\
       --no-allow-raw-read  mark written blocks to disallow raw reads of\n\
                            encrypted data\n\
       --ckod               clear key on demount of tape media\n\
+      --ckorp              clear key when this host's persistent reservation\n\
+                           of DEVICE is preempted\n\
+      --ckorl              clear key when this host loses its reservation of\n\
+                           DEVICE\n\
+      --scope=SCOPE        apply the key to SCOPE: all (default) for all\n\
+                           hosts, or local for this host only\n\
+      --policy=FILE        take the key file and encryption settings for\n\
+                           the tape with barcode BARCODE or key descriptor\n\
+                           DESC, and the scope for DEVICE, from FILE\n\
+      --barcode=BARCODE    barcode of the tape to look up in the policy\n\
+      --key-descriptor=DESC\n\
+                           key descriptor of the data on the tape to look\n\
+                           up in the policy, e.g. to restore it\n\
+      --hook=LIBRARY       call the hooks in the shared LIBRARY before and\n\
+                           after changing encryption settings\n\
+      --hook-timeout=SECS  give up on hooks after SECS seconds (default 30)\n\
+      --spread=SECS        change one device at a time over SECS seconds,\n\
+                           leaving busy devices until they are idle\n\
+      --reservation-wait=SECS\n\
+                           wait at most SECS seconds for another host to\n\
+                           release its reservation of DEVICE (default 0)\n\
+      --lock-timeout=SECS  wait at most SECS seconds for other stenc\n\
+                           processes using DEVICE (default 60)\n\
+      --gentle             do not query the volume status of drives that\n\
+                           are busy reading or writing\n\
+      --driver-status      ask the st driver instead of the drive whether a\n\
+                           tape is loaded, where DEVICE is an st device\n\
+      --watch=SECS         query devices every SECS seconds and print a line\n\
+                           for each change until interrupted\n\
+      --events=LIST        print only changes of the comma-separated types\n\
+                           in LIST with --watch\n\
+      --table              print status as a table with one row per device\n\
+      --columns=LIST       print the comma-separated columns in LIST in the\n\
+                           status table\n\
+      --sort=COLUMN        sort the status table by COLUMN\n\
+      --where=LIST         list only devices in the state given by the\n\
+                           comma-separated KEY=VALUE pairs in LIST\n\
+      --check=LIST         silently check that DEVICE is in the state given\n\
+                           by the comma-separated KEY=VALUE pairs in LIST\n\
+      --purge-all          turn encryption and decryption off on all tape\n\
+                           drives found on the system at once, clearing\n\
+                           their keys\n\
   -h, --help               print this usage statement and exit\n\
       --version            print version information and exit\n\
 \n\
@@ -118,89 +220,16 @@ INDEX is a number that selects the encryption algorithm and mode to use.\n\
 \n\
 When neither options to set encryption or decryption mode are given, print\n\
 encryption status and capabilities of DEVICE, including a list of supported\n\
-algorithm indexes.\n";
-}
-
-static void print_algorithm_name(std::ostream& os, const std::uint32_t code)
-{
-  // Reference: SFSC / INCITS 501-2016
-  if (0x80010400 <= code && code <= 0x8001FFFF) {
-    os << "Vendor specific 0x" << std::setw(8) << std::setfill('0') << std::hex
-       << code << std::setfill(' ');
-  }
-  switch (code) {
-  case 0x0001000C:
-    os << "AES-256-CBC-HMAC-SHA-1";
-    break;
-  case 0x00010010:
-    os << "AES-256-CCM-128";
-    break;
-  case 0x00010014:
-    os << "AES-256-GCM-128";
-    break;
-  case 0x00010016:
-    os << "AES-256-XTS-HMAC-SHA-512";
-    break;
-  default:
-    os << "Unknown 0x" << std::setw(8) << std::setfill('0') << std::hex << code
-       << std::setfill(' ');
-  }
-}
-
-static void print_algorithms(std::ostream& os, const scsi::page_dec& page)
-{
-  os << "Supported algorithms:\n";
-
-  for (const scsi::algorithm_descriptor& ad: scsi::read_algorithms(page)) {
-    os << std::left << std::setw(5)
-       << static_cast<unsigned int>(ad.algorithm_index);
-    print_algorithm_name(os, ntohl(ad.security_algorithm_code));
-    os.put('\n');
-
-    // Print KAD capabilities and size
-    auto dkad_c {static_cast<unsigned int>(
-        ad.flags3 & scsi::algorithm_descriptor::flags3_dkad_c_mask)};
-    if (dkad_c == 2u << scsi::algorithm_descriptor::flags3_dkad_c_pos) {
-      os << std::left << std::setw(5) << ""
-         << "Key descriptors not allowed\n";
-    } else if (dkad_c) {
-      os << std::left << std::setw(5) << "";
-      if (dkad_c == 1u << scsi::algorithm_descriptor::flags3_dkad_c_pos) {
-        os << "Key descriptors required, ";
-      } else {
-        os << "Key descriptors allowed, ";
-      }
-      if ((ad.flags2 & scsi::algorithm_descriptor::flags2_ukadf_mask) ==
-          scsi::algorithm_descriptor::flags2_ukadf_mask) {
-        os << "fixed ";
-      } else {
-        os << "maximum ";
-      }
-      os << std::dec << ntohs(ad.maximum_ukad_length) << " bytes\n";
-    }
-
-    // Print raw decryption mode capability:
-    auto rdmc_c {static_cast<unsigned int>(
-        ad.flags3 & scsi::algorithm_descriptor::flags3_rdmc_c_mask)};
-    switch (rdmc_c) {
-    case 1u << scsi::algorithm_descriptor::flags3_rdmc_c_pos:
-    case 6u << scsi::algorithm_descriptor::flags3_rdmc_c_pos:
-      os << std::left << std::setw(5) << "";
-      os << "Raw decryption mode not allowed\n";
-      break;
-    case 4u << scsi::algorithm_descriptor::flags3_rdmc_c_pos:
-    case 5u << scsi::algorithm_descriptor::flags3_rdmc_c_pos:
-    case 7u << scsi::algorithm_descriptor::flags3_rdmc_c_pos:
-      os << std::left << std::setw(5) << "";
-      os << "Raw decryption mode allowed, raw read ";
-      if (rdmc_c == 4u << scsi::algorithm_descriptor::flags3_rdmc_c_pos) {
-        os << "disabled by default\n";
-      } else {
-        os << "enabled by default\n";
-      }
-      break;
-    }
-  }
+algorithm indexes.\n\
+\n\
+Status table columns are device, vendor, product, revision, enc, dec, alg,\n\
+kic, ukad, scope, volume, latency and health.\n\
+\n\
+Check keys are enc, dec, alg, ukad, scope (local or all) and media (yes or\n\
+no). --check exits with 0 on match, 2 on mismatch, 3 if media is required\n\
+but not loaded and 1 on errors.\n\
+\n\
+--where takes the check keys and health (ok or error).\n";
 }
 
 static void print_device_inquiry(std::ostream& os,
@@ -264,6 +293,25 @@ static void print_device_status(std::ostream& os, const scsi::page_des& opt)
     os << std::setw(25) << " "
        << "Protecting from raw read\n";
   }
+  if (opt.encryption_mode != scsi::encrypt_mode::off ||
+      opt.decryption_mode != scsi::decrypt_mode::off) {
+    os << std::setw(25) << "Key Scope:";
+    switch (opt.it_nexus_scope()) {
+    case scsi::nexus_scope::public_scope:
+      os << "Public\n";
+      break;
+    case scsi::nexus_scope::local:
+      os << "Local, this host only\n";
+      break;
+    case scsi::nexus_scope::all_it_nexus:
+      os << "All hosts\n";
+      break;
+    default:
+      os << "Unknown '0x" << std::hex
+         << static_cast<unsigned int>(opt.it_nexus_scope()) << "'\n";
+      break;
+    }
+  }
 
   os << std::setw(25) << "Key Instance Counter:" << std::dec
      << ntohl(opt.key_instance_counter) << '\n';
@@ -354,6 +402,207 @@ static void print_volume_status(std::ostream& os, const scsi::page_nbes& opt)
   }
 }
 
+enum class table_column {
+  device,
+  vendor,
+  product,
+  revision,
+  enc,
+  dec,
+  alg,
+  kic,
+  ukad,
+  scope,
+  volume,
+  latency,
+  health,
+};
+
+struct table_column_info {
+  table_column column;
+  const char *name;    // as given to --columns and --sort
+  const char *heading; // as printed in the table header
+};
+
+// indexed by table_column
+constexpr table_column_info table_columns[] {
+    {table_column::device, "device", "DEVICE"},
+    {table_column::vendor, "vendor", "VENDOR"},
+    {table_column::product, "product", "PRODUCT"},
+    {table_column::revision, "revision", "REV"},
+    {table_column::enc, "enc", "ENC"},
+    {table_column::dec, "dec", "DEC"},
+    {table_column::alg, "alg", "ALG"},
+    {table_column::kic, "kic", "KIC"},
+    {table_column::ukad, "ukad", "UKAD"},
+    {table_column::scope, "scope", "SCOPE"},
+    {table_column::volume, "volume", "VOLUME"},
+    {table_column::latency, "latency", "LATENCY"},
+    {table_column::health, "health", "HEALTH"},
+};
+
+constexpr table_column default_table_columns[] {
+    table_column::device, table_column::product, table_column::enc,
+    table_column::dec,    table_column::alg,     table_column::kic,
+    table_column::ukad,   table_column::volume,  table_column::latency,
+    table_column::health,
+};
+
+static std::optional<table_column> table_column_from_name(std::string_view name)
+{
+  for (const auto& info: table_columns) {
+    if (name == info.name) {
+      return info.column;
+    }
+  }
+  return {};
+}
+
+// Parse a comma-separated list of column names
+static std::optional<std::vector<table_column>>
+table_columns_from_list(const std::string& list)
+{
+  std::vector<table_column> columns;
+  std::string_view rest {list};
+
+  while (!rest.empty()) {
+    auto comma {rest.find(',')};
+    auto column {table_column_from_name(rest.substr(0, comma))};
+    if (!column) {
+      return {};
+    }
+    columns.push_back(*column);
+    rest = comma == rest.npos ? std::string_view {} : rest.substr(comma + 1);
+  }
+  if (columns.empty()) {
+    return {};
+  }
+  return columns;
+}
+
+static std::string table_cell(const stenc::drive_state& state,
+                              table_column column)
+{
+  std::ostringstream oss;
+
+  switch (column) {
+  case table_column::device:
+    return state.device;
+  case table_column::vendor:
+    return state.vendor;
+  case table_column::product:
+    return state.product;
+  case table_column::revision:
+    return state.revision;
+  case table_column::health:
+    return state.error.empty() ? "ok" : "error";
+  case table_column::volume:
+    return to_string(state.volume);
+  case table_column::latency:
+    oss << std::fixed << std::setprecision(1)
+        << state.latency.count() / 1000.0 << "ms";
+    return oss.str();
+  default:
+    break;
+  }
+
+  if (!state.des_valid) {
+    return "-";
+  }
+  switch (column) {
+  case table_column::enc:
+    oss << state.encryption_mode;
+    break;
+  case table_column::dec:
+    oss << state.decryption_mode;
+    break;
+  case table_column::alg:
+    oss << static_cast<unsigned int>(state.algorithm_index);
+    break;
+  case table_column::kic:
+    oss << state.key_instance_counter;
+    break;
+  case table_column::ukad: {
+    // drives with fixed length key descriptors return them space padded
+    const auto end {state.ukad.find_last_not_of(' ')};
+    return end == state.ukad.npos ? "-" : state.ukad.substr(0, end + 1);
+  }
+  case table_column::scope:
+    oss << state.scope;
+    break;
+  default:
+    break;
+  }
+  return oss.str();
+}
+
+static bool table_less(const stenc::drive_state& lhs,
+                       const stenc::drive_state& rhs, table_column column)
+{
+  switch (column) {
+  case table_column::alg:
+    return lhs.algorithm_index < rhs.algorithm_index;
+  case table_column::kic:
+    return lhs.key_instance_counter < rhs.key_instance_counter;
+  case table_column::latency:
+    return lhs.latency < rhs.latency;
+  default:
+    return table_cell(lhs, column) < table_cell(rhs, column);
+  }
+}
+
+// Print one row per drive. The table is formatted into a single buffer and
+// written at once, which matters when listing hundreds of drives.
+static void print_table(std::ostream& os,
+                        const std::vector<stenc::drive_state>& states,
+                        const std::vector<table_column>& columns,
+                        std::optional<table_column> sort_by)
+{
+  std::vector<std::size_t> order(states.size());
+  for (std::size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  if (sort_by) {
+    std::stable_sort(order.begin(), order.end(),
+                     [&](std::size_t lhs, std::size_t rhs) {
+                       return table_less(states[lhs], states[rhs], *sort_by);
+                     });
+  }
+
+  std::vector<std::vector<std::string>> rows;
+  rows.reserve(states.size() + 1);
+  rows.emplace_back();
+  for (auto column: columns) {
+    rows.back().emplace_back(
+        table_columns[static_cast<std::size_t>(column)].heading);
+  }
+  for (auto i: order) {
+    rows.emplace_back();
+    for (auto column: columns) {
+      rows.back().push_back(table_cell(states[i], column));
+    }
+  }
+
+  std::vector<std::size_t> widths(columns.size());
+  for (const auto& row: rows) {
+    for (std::size_t c = 0; c < row.size(); c++) {
+      widths[c] = std::max(widths[c], row[c].size());
+    }
+  }
+
+  std::string out;
+  for (const auto& row: rows) {
+    for (std::size_t c = 0; c < row.size(); c++) {
+      out += row[c];
+      if (c + 1 < row.size()) {
+        out.append(widths[c] - row[c].size() + 2, ' ');
+      }
+    }
+    out += '\n';
+  }
+  os.write(out.data(), out.size());
+}
+
 static void echo(bool on)
 {
   struct termios settings {};
@@ -363,28 +612,268 @@ static void echo(bool on)
   tcsetattr(STDIN_FILENO, TCSANOW, &settings);
 }
 
+// Output of the operation on one device. Output is buffered so that devices
+// handled in parallel do not interleave their messages.
+struct device_report {
+  std::string device; // path the report was obtained through
+  std::ostringstream out;
+  std::ostringstream err;
+  std::vector<std::uint8_t> dec_page; // copy of the DEC page, if read
+  bool ok {true};
+};
+
+// Exit statuses of --check besides EXIT_SUCCESS (match) and EXIT_FAILURE
+constexpr int CHECK_EXIT_MISMATCH {2};
+constexpr int CHECK_EXIT_NO_MEDIA {3};
+
+// Upper bound on devices handled at the same time
+constexpr std::size_t MAX_PARALLEL_DEVICES {32u};
+// Upper bound on device handles kept open between commands
+constexpr std::size_t MAX_OPEN_DEVICES {2u * MAX_PARALLEL_DEVICES};
+// How often --spread looks for busy drives that have become idle
+constexpr std::chrono::seconds SPREAD_RETRY_INTERVAL {5};
+
+// Run op(device, report) for every device, on up to parallel devices at a
+// time when there is more than one, and return the reports in the order of
+// devices. If fewer threads can be started, the devices are shared among
+// those that were.
+template <typename Report, typename Device, typename Operation>
+static std::vector<Report>
+for_each_device(const std::vector<Device>& devices, Operation op,
+                std::size_t parallel = MAX_PARALLEL_DEVICES)
+{
+  std::vector<Report> reports(devices.size());
+
+  if (devices.size() == 1) {
+    op(devices[0], reports[0]);
+    return reports;
+  }
+
+  std::atomic<std::size_t> next {0u};
+  auto worker {[&]() {
+    for (std::size_t i; (i = next++) < devices.size();) {
+      op(devices[i], reports[i]);
+    }
+  }};
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < std::min(devices.size(), parallel); i++) {
+    try {
+      threads.emplace_back(worker);
+    } catch (const std::system_error&) {
+      // out of threads or memory for their stacks
+      break;
+    }
+  }
+  if (threads.empty()) {
+    worker();
+  }
+  for (auto& t: threads) {
+    t.join();
+  }
+  return reports;
+}
+
+static void query_status(const std::string& device,
+                         std::chrono::seconds lock_timeout,
+                         device_report& report, bool gentle)
+{
+  alignas(4) scsi::page_buffer buffer {};
+  auto& os {report.out};
+  const bool busy {gentle && stenc::is_drive_busy(device)};
+
+  report.device = device;
+  os.str({}); // discard output of a failed path
+  os << "Status for " << device << '\n'
+     << "--------------------------------------------------\n";
+
+  try {
+    stenc::device_lock lock {device, stenc::lock_mode::shared, lock_timeout};
+    auto inquiry {scsi::get_inquiry(device)};
+    const auto& quirks {stenc::find_quirks(inquiry)};
+    print_device_inquiry(os, inquiry);
+    scsi::get_des(device, buffer, sizeof(buffer));
+    print_device_status(os, reinterpret_cast<const scsi::page_des&>(buffer));
+    if (busy) {
+      os << std::left << std::setw(25) << "Volume Encryption:"
+         << "Not queried, drive is busy\n";
+    } else if (!quirks.no_nbes && scsi::is_device_ready(device)) {
+      try {
+        scsi::get_nbes(device, buffer, sizeof(buffer));
+        print_volume_status(os,
+                            reinterpret_cast<const scsi::page_nbes&>(buffer));
+      } catch (const scsi::scsi_error& err) {
+        if (!quirks.nbes_blank_check ||
+            err.sense().sense_key() != scsi::sense_data::blank_check) {
+          throw;
+        }
+      }
+    }
+    scsi::get_dec(device, buffer, sizeof(buffer));
+    auto& page {reinterpret_cast<const scsi::page_header&>(buffer)};
+    report.dec_page.assign(
+        buffer, buffer + std::min(sizeof(buffer), sizeof(scsi::page_header) +
+                                                      ntohs(page.length)));
+  } catch (const scsi::transport_error&) {
+    throw;
+  } catch (const scsi::reservation_conflict& err) {
+    report.err << "stenc: " << err.what() << '\n';
+    try {
+      scsi::print_reservation(report.err, scsi::get_reservation(device));
+    } catch (const std::runtime_error&) {
+      // drive does not support persistent reservations
+    }
+    report.ok = false;
+  } catch (const scsi::scsi_error& err) {
+    report.err << "stenc: " << err.what() << '\n';
+    scsi::print_sense_data(report.err, err.sense());
+    report.ok = false;
+  } catch (const std::runtime_error& err) {
+    report.err << "stenc: " << err.what() << '\n';
+    report.ok = false;
+  }
+}
+
+// Identify the drives behind devices, so that a drive seen through several
+// paths is handled once. A single device is not probed.
+static std::vector<stenc::drive_paths>
+find_drives(const std::vector<std::string>& devices)
+{
+  if (devices.size() == 1) {
+    return {{{}, devices}};
+  }
+  auto probes {for_each_device<stenc::path_probe>(
+      devices, [](const std::string& device, stenc::path_probe& probe) {
+        probe = stenc::probe_path(device);
+      })};
+  return stenc::group_paths(probes);
+}
+
+// Run op on drive with failover, then close the drive's device handles,
+// since st devices can be opened by only one process at a time
+template <typename Operation>
+static bool on_drive(const stenc::drive_paths& drive, std::ostream& err,
+                     Operation op)
+{
+  auto ok {stenc::with_failover(drive, err, op)};
+  for (const auto& path: drive.paths) {
+    scsi::close_session(path);
+  }
+  return ok;
+}
+
+// Query the state of drive for the status table and --watch
+static void query_drive(const stenc::drive_paths& drive,
+                        std::chrono::seconds lock_timeout, bool gentle,
+                        stenc::drive_state& state)
+{
+  std::ostringstream err;
+  auto ok {on_drive(drive, err, [&](const std::string& device) {
+    state = {};
+    stenc::query_state(device, lock_timeout, state, gentle);
+  })};
+  if (!ok) {
+    state.device = drive.paths.front();
+    state.error = "Transport error on all paths";
+  }
+}
+
+// Query drives every interval and print the events for their changes in
+// the types in mask, until killed
+[[noreturn]] static void watch_drives(
+    const std::vector<stenc::drive_paths>& drives,
+    std::chrono::seconds interval, stenc::event_mask mask,
+    std::chrono::seconds lock_timeout, bool gentle)
+{
+  std::vector<stenc::drive_state> previous;
+  for (;;) {
+    const auto next {std::chrono::steady_clock::now() + interval};
+    auto states {for_each_device<stenc::drive_state>(
+        drives, [lock_timeout, gentle](const stenc::drive_paths& drive,
+                                       stenc::drive_state& state) {
+          query_drive(drive, lock_timeout, gentle, state);
+        })};
+    // the first round is the baseline that changes are reported against
+    if (!previous.empty()) {
+      const auto now {std::time(nullptr)};
+      for (std::size_t i = 0; i < states.size(); i++) {
+        for (const auto& event: stenc::diff_states(previous[i], states[i])) {
+          if (mask & stenc::mask_of(event.type)) {
+            stenc::print_event(std::cout, event, now);
+          }
+        }
+      }
+      std::cout.flush();
+    }
+    previous = std::move(states);
+    std::this_thread::sleep_until(next);
+  }
+}
+
 #if !defined(CATCH_CONFIG_MAIN)
 int main(int argc, char **argv)
 {
-  std::string tapeDrive;
+  std::vector<std::string> tapeDrives;
+  bool all_drives {};
   std::string keyFile;
 
   std::optional<scsi::encrypt_mode> enc_mode;
   std::optional<scsi::decrypt_mode> dec_mode;
   std::optional<std::uint8_t> algorithm_index;
-  std::vector<uint8_t> key;
+  // set up only when changing settings, as is the system log
+  std::optional<stenc::key_arena> arena;
+  stenc::key_slot key;
   std::string key_name;
   scsi::sde_rdmc rdmc {};
-  scsi::kadf kad_format {};
   bool ckod {};
-
-  alignas(4) scsi::page_buffer buffer {};
+  bool ckorp {};
+  bool ckorl {};
+  std::chrono::seconds reservation_wait {};
+  std::optional<std::chrono::seconds> spread;
+  std::optional<scsi::nexus_scope> scope;
+  std::chrono::seconds lock_timeout {60};
+  std::string hook_library;
+  std::chrono::seconds hook_timeout {30};
+  bool gentle {};
+  std::string policy_file;
+  std::string barcode;
+  std::string tape_ukad;
+  bool table_format {};
+  std::optional<std::chrono::seconds> watch_interval;
+  std::optional<stenc::event_mask> events;
+  std::vector<table_column> table_column_list {
+      std::begin(default_table_columns), std::end(default_table_columns)};
+  std::optional<table_column> table_sort;
+  std::optional<stenc::fleet_query> table_filter;
+  std::optional<stenc::drive_expectation> expected_state;
+  bool purge_all {};
 
   enum opt_key : int {
     opt_version = 256,
     opt_ckod,
+    opt_ckorp,
+    opt_ckorl,
+    opt_reservation_wait,
+    opt_spread,
+    opt_scope,
+    opt_all,
+    opt_hook,
+    opt_hook_timeout,
+    opt_policy,
+    opt_barcode,
+    opt_key_descriptor,
     opt_rdmc_enable,
     opt_rdmc_disable,
+    opt_lock_timeout,
+    opt_gentle,
+    opt_driver_status,
+    opt_table,
+    opt_watch,
+    opt_events,
+    opt_columns,
+    opt_sort,
+    opt_where,
+    opt_check,
+    opt_purge_all,
   };
 
   const struct option long_options[] = {
@@ -395,8 +884,30 @@ int main(int argc, char **argv)
       {"key-file", required_argument, nullptr, 'k'},
       {"help", no_argument, nullptr, 'h'},
       {"ckod", no_argument, nullptr, opt_ckod},
+      {"ckorp", no_argument, nullptr, opt_ckorp},
+      {"ckorl", no_argument, nullptr, opt_ckorl},
+      {"reservation-wait", required_argument, nullptr, opt_reservation_wait},
+      {"spread", required_argument, nullptr, opt_spread},
+      {"scope", required_argument, nullptr, opt_scope},
+      {"all", no_argument, nullptr, opt_all},
+      {"hook", required_argument, nullptr, opt_hook},
+      {"hook-timeout", required_argument, nullptr, opt_hook_timeout},
+      {"policy", required_argument, nullptr, opt_policy},
+      {"barcode", required_argument, nullptr, opt_barcode},
+      {"key-descriptor", required_argument, nullptr, opt_key_descriptor},
       {"allow-raw-read", no_argument, nullptr, opt_rdmc_enable},
       {"no-allow-raw-read", no_argument, nullptr, opt_rdmc_disable},
+      {"lock-timeout", required_argument, nullptr, opt_lock_timeout},
+      {"gentle", no_argument, nullptr, opt_gentle},
+      {"driver-status", no_argument, nullptr, opt_driver_status},
+      {"table", no_argument, nullptr, opt_table},
+      {"watch", required_argument, nullptr, opt_watch},
+      {"events", required_argument, nullptr, opt_events},
+      {"columns", required_argument, nullptr, opt_columns},
+      {"sort", required_argument, nullptr, opt_sort},
+      {"where", required_argument, nullptr, opt_where},
+      {"check", required_argument, nullptr, opt_check},
+      {"purge-all", no_argument, nullptr, opt_purge_all},
       {"version", no_argument, nullptr, opt_version},
       {nullptr, 0, nullptr, 0},
   };
@@ -407,6 +918,7 @@ int main(int argc, char **argv)
     switch (opt_char) {
     case 'a': {
       char *endptr;
+      errno = 0;
       auto conv_result {std::strtoul(optarg, &endptr, 10)};
       if (errno || *endptr ||
           conv_result > std::numeric_limits<
@@ -441,7 +953,7 @@ int main(int argc, char **argv)
       }
     } break;
     case 'f':
-      tapeDrive = optarg;
+      tapeDrives.emplace_back(optarg);
       break;
     case 'k':
       keyFile = optarg;
@@ -449,12 +961,144 @@ int main(int argc, char **argv)
     case opt_ckod:
       ckod = true;
       break;
+    case opt_ckorp:
+      ckorp = true;
+      break;
+    case opt_ckorl:
+      ckorl = true;
+      break;
+    case opt_reservation_wait: {
+      char *endptr;
+      errno = 0;
+      auto conv_result {std::strtoul(optarg, &endptr, 10)};
+      if (errno || *endptr || *optarg == '\0') {
+        std::cerr << "stenc: Invalid reservation wait " << optarg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      reservation_wait = std::chrono::seconds {conv_result};
+    } break;
+    case opt_spread: {
+      char *endptr;
+      errno = 0;
+      auto conv_result {std::strtoul(optarg, &endptr, 10)};
+      if (errno || *endptr || *optarg == '\0') {
+        std::cerr << "stenc: Invalid spread window " << optarg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      spread = std::chrono::seconds {conv_result};
+    } break;
+    case opt_all:
+      all_drives = true;
+      break;
+    case opt_hook:
+      hook_library = optarg;
+      break;
+    case opt_hook_timeout: {
+      char *endptr;
+      errno = 0;
+      auto conv_result {std::strtoul(optarg, &endptr, 10)};
+      if (errno || *endptr || *optarg == '\0') {
+        std::cerr << "stenc: Invalid hook timeout " << optarg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      hook_timeout = std::chrono::seconds {conv_result};
+    } break;
+    case opt_scope:
+      if (optarg == "local"s) {
+        scope = scsi::nexus_scope::local;
+      } else if (optarg == "all"s) {
+        scope = scsi::nexus_scope::all_it_nexus;
+      } else {
+        std::cerr << "stenc: Invalid scope " << optarg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      break;
+    case opt_policy:
+      policy_file = optarg;
+      break;
+    case opt_barcode:
+      barcode = optarg;
+      break;
+    case opt_key_descriptor:
+      tape_ukad = optarg;
+      break;
     case opt_rdmc_enable:
       rdmc = scsi::sde_rdmc::enabled;
       break;
     case opt_rdmc_disable:
       rdmc = scsi::sde_rdmc::disabled;
       break;
+    case opt_lock_timeout: {
+      char *endptr;
+      errno = 0;
+      auto conv_result {std::strtoul(optarg, &endptr, 10)};
+      if (errno || *endptr || *optarg == '\0') {
+        std::cerr << "stenc: Invalid lock timeout " << optarg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      lock_timeout = std::chrono::seconds {conv_result};
+    } break;
+    case opt_gentle:
+      gentle = true;
+      break;
+    case opt_driver_status:
+      scsi::set_driver_status(true);
+      break;
+    case opt_table:
+      table_format = true;
+      break;
+    case opt_watch: {
+      char *endptr;
+      errno = 0;
+      auto conv_result {std::strtoul(optarg, &endptr, 10)};
+      if (errno || *endptr || conv_result == 0) {
+        std::cerr << "stenc: Invalid watch interval " << optarg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      watch_interval = std::chrono::seconds {conv_result};
+    } break;
+    case opt_events:
+      events = stenc::parse_event_mask(optarg);
+      if (!events) {
+        std::cerr << "stenc: Invalid event types " << optarg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      break;
+    case opt_columns:
+      if (auto columns {table_columns_from_list(optarg)}) {
+        table_column_list = *columns;
+      } else {
+        std::cerr << "stenc: Invalid column list " << optarg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      table_format = true;
+      break;
+    case opt_sort:
+      table_sort = table_column_from_name(optarg);
+      if (!table_sort) {
+        std::cerr << "stenc: Invalid sort column " << optarg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      table_format = true;
+      break;
+    case opt_where:
+      table_filter = stenc::parse_fleet_query(optarg);
+      if (!table_filter) {
+        std::cerr << "stenc: Invalid filter " << optarg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      table_format = true;
+      break;
+    case opt_check:
+      expected_state = stenc::parse_expectation(optarg);
+      if (!expected_state) {
+        std::cerr << "stenc: Invalid check " << optarg << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      break;
+    case opt_purge_all:
+      purge_all = true;
+      break;
     case 'h':
       print_usage(std::cout);
       std::exit(EXIT_SUCCESS);
@@ -471,57 +1115,294 @@ int main(int argc, char **argv)
     print_usage(std::cerr);
     std::exit(EXIT_FAILURE);
   }
+  if (table_format && (enc_mode || dec_mode)) {
+    std::cerr << "stenc: --table only applies to device status\n";
+    std::exit(EXIT_FAILURE);
+  }
+  if (expected_state && (enc_mode || dec_mode || table_format)) {
+    std::cerr << "stenc: --check cannot be combined with other operations\n";
+    std::exit(EXIT_FAILURE);
+  }
+  if (watch_interval &&
+      (enc_mode || dec_mode || table_format || expected_state)) {
+    std::cerr << "stenc: --watch cannot be combined with other operations\n";
+    std::exit(EXIT_FAILURE);
+  }
+  if (purge_all &&
+      (enc_mode || dec_mode || !keyFile.empty() || !tapeDrives.empty() ||
+       all_drives || table_format || expected_state || watch_interval ||
+       spread || !hook_library.empty() || !policy_file.empty())) {
+    std::cerr << "stenc: --purge-all cannot be combined with other "
+                 "operations\n";
+    std::exit(EXIT_FAILURE);
+  }
+  if (events && !watch_interval) {
+    std::cerr << "stenc: --events only applies to --watch\n";
+    std::exit(EXIT_FAILURE);
+  }
+  const auto watch_events {events.value_or(stenc::all_events)};
+
+  // kept for the drive rules, which apply once the drives are known
+  std::optional<stenc::policy> key_policy;
+  // the scope of the rule for the tape, overridden by drive rules
+  std::optional<scsi::nexus_scope> tape_scope;
+  if (!policy_file.empty() || !barcode.empty() || !tape_ukad.empty()) {
+    if (policy_file.empty()) {
+      std::cerr << "stenc: --barcode and --key-descriptor require --policy\n";
+      std::exit(EXIT_FAILURE);
+    }
+    if (!barcode.empty() && !tape_ukad.empty()) {
+      std::cerr << "stenc: --barcode cannot be combined with "
+                   "--key-descriptor\n";
+      std::exit(EXIT_FAILURE);
+    }
+    if (table_format || expected_state) {
+      std::cerr << "stenc: --policy only applies to changing encryption "
+                   "settings\n";
+      std::exit(EXIT_FAILURE);
+    }
+    try {
+      key_policy = stenc::load_policy(policy_file);
+    } catch (const std::runtime_error& e) {
+      std::cerr << "stenc: " << e.what() << '\n';
+      std::exit(EXIT_FAILURE);
+    }
+    if (!barcode.empty() || !tape_ukad.empty()) {
+      const bool by_barcode {!barcode.empty()};
+      const auto& value {by_barcode ? barcode : tape_ukad};
+      const auto rule {key_policy->match(by_barcode
+                                             ? stenc::policy_key::barcode
+                                             : stenc::policy_key::ukad,
+                                         value)};
+      const auto what {by_barcode ? "barcode "s : "key descriptor "s};
+      if (rule == nullptr) {
+        std::cerr << "stenc: No policy rule for " << what << value << '\n';
+        std::exit(EXIT_FAILURE);
+      }
+      std::cerr << "Using policy rule " << rule->pattern << " (line "
+                << rule->line << ") for " << what << value << '\n';
+      // settings given on the command line take precedence
+      if (!enc_mode && !dec_mode) {
+        enc_mode = rule->settings.enc_mode;
+        dec_mode = rule->settings.dec_mode;
+      }
+      if (keyFile.empty()) {
+        keyFile = rule->key_file;
+      }
+      if (!algorithm_index) {
+        algorithm_index = rule->settings.algorithm_index;
+      }
+      tape_scope = rule->settings.scope;
+      if (!enc_mode && !dec_mode) {
+        std::cerr << "stenc: Policy rule sets no encryption mode\n";
+        std::exit(EXIT_FAILURE);
+      }
+    } else if (!enc_mode && !dec_mode) {
+      std::cerr << "stenc: --policy only applies to changing encryption "
+                   "settings\n";
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  if (spread && !enc_mode && !dec_mode) {
+    std::cerr << "stenc: --spread only applies to changing encryption "
+                 "settings\n";
+    std::exit(EXIT_FAILURE);
+  }
+
+  stenc::change_hooks hooks;
+  if (!hook_library.empty()) {
+    if (!enc_mode && !dec_mode) {
+      std::cerr << "stenc: --hook only applies to changing encryption "
+                   "settings\n";
+      std::exit(EXIT_FAILURE);
+    }
+    try {
+      hooks = stenc::make_change_hooks(stenc::load_hooks(hook_library),
+                                       hook_timeout);
+    } catch (const std::runtime_error& e) {
+      std::cerr << "stenc: " << e.what() << '\n';
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  if (all_drives || purge_all) {
+    if (!tapeDrives.empty()) {
+      std::cerr << "stenc: --all cannot be combined with -f\n";
+      std::exit(EXIT_FAILURE);
+    }
+    tapeDrives = stenc::discover_devices();
+    if (tapeDrives.empty()) {
+      std::cerr << "stenc: No tape drives found\n";
+      std::exit(EXIT_FAILURE);
+    }
+  }
 
   // select device from env variable or system default if not given with -f
-  if (tapeDrive.empty()) {
+  if (tapeDrives.empty()) {
     const char *env_tape = getenv("TAPE");
     if (env_tape != nullptr) {
-      tapeDrive = env_tape;
+      tapeDrives.emplace_back(env_tape);
     } else {
-      tapeDrive = DEFTAPE;
+      tapeDrives.emplace_back(DEFTAPE);
     }
   }
+  // reuse device handles across the commands sent to each drive
+  scsi::set_session_capacity(MAX_OPEN_DEVICES);
 
-  openlog("stenc", LOG_CONS, LOG_USER);
+  if (purge_all) {
+    struct purge_report {
+      bool ok {};
+      // from the start of the purge until the key was found cleared
+      std::chrono::milliseconds elapsed {};
+      std::ostringstream err;
+    };
+    openlog("stenc", LOG_CONS, LOG_USER);
+    const auto audit {[](const std::string& record) {
+      syslog(LOG_NOTICE, "%s", record.c_str());
+    }};
+    // every drive at once, without the usual limit
+    scsi::set_session_capacity(std::max(MAX_OPEN_DEVICES, tapeDrives.size()));
+    // every path is purged as found, without probing which paths lead to
+    // the same drive first
+    const auto start {std::chrono::steady_clock::now()};
+    auto reports {for_each_device<purge_report>(
+        tapeDrives,
+        [&audit, start](const std::string& path, purge_report& report) {
+          const stenc::drive_paths drive {{}, {path}};
+          auto ok {on_drive(drive, report.err, [&](const std::string& device) {
+            report.ok = stenc::purge_key(device, report.err, audit);
+          })};
+          report.ok = report.ok && ok;
+          report.elapsed =
+              std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - start);
+        },
+        tapeDrives.size())};
+    const auto elapsed {std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start)};
 
-  if (!enc_mode && !dec_mode) {
-    std::cout << "Status for " << tapeDrive << '\n'
-              << "--------------------------------------------------\n";
+    std::size_t cleared {};
+    for (std::size_t i = 0; i < reports.size(); i++) {
+      std::cerr << reports[i].err.str();
+      std::cout << tapeDrives[i] << ": "
+                << (reports[i].ok ? "cleared" : "FAILED") << " after "
+                << std::dec << reports[i].elapsed.count() << " ms\n";
+      cleared += reports[i].ok;
+    }
+    std::cout << "Cleared keys of " << cleared << " of " << reports.size()
+              << " devices in " << elapsed.count() << " ms\n";
+    std::exit(cleared == reports.size() ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
 
-    try {
-      print_device_inquiry(std::cout, scsi::get_inquiry(tapeDrive));
-      scsi::get_des(tapeDrive, buffer, sizeof(buffer));
-      print_device_status(std::cout,
-                          reinterpret_cast<const scsi::page_des&>(buffer));
-      if (scsi::is_device_ready(tapeDrive)) {
-        try {
-          scsi::get_nbes(tapeDrive, buffer, sizeof(buffer));
-          print_volume_status(std::cout,
-                              reinterpret_cast<const scsi::page_nbes&>(buffer));
-        } catch (const scsi::scsi_error& err) {
-          // #71: ignore BLANK CHECK sense key that some drives may return
-          // during media access check in getting NBES
-          auto sense_key {err.get_sense().flags &
-                          scsi::sense_data::flags_sense_key_mask};
-          if (sense_key != scsi::sense_data::blank_check) {
-            throw;
+  const auto drives {find_drives(tapeDrives)};
+
+  if (expected_state) {
+    struct check_report {
+      stenc::check_result result {};
+      std::ostringstream err;
+    };
+    auto reports {for_each_device<check_report>(
+        drives, [&expected_state, lock_timeout,
+                 gentle](const stenc::drive_paths& drive,
+                         check_report& report) {
+          auto ok {on_drive(
+              drive, report.err, [&](const std::string& device) {
+                report.result = stenc::check_device(
+                    device, *expected_state, lock_timeout, report.err, gentle);
+              })};
+          if (!ok) {
+            report.result = stenc::check_result::error;
           }
-        }
-      }
-      scsi::get_dec(tapeDrive, buffer, sizeof(buffer));
-      print_algorithms(std::cout,
-                       reinterpret_cast<const scsi::page_dec&>(buffer));
+        })};
+
+    // report the most severe result over all devices
+    auto result {stenc::check_result::match};
+    for (const auto& report: reports) {
+      std::cerr << report.err.str();
+      result = std::max(result, report.result);
+    }
+    switch (result) {
+    case stenc::check_result::match:
       std::exit(EXIT_SUCCESS);
-    } catch (const scsi::scsi_error& err) {
-      std::cerr << "stenc: " << err.what() << '\n';
-      scsi::print_sense_data(std::cerr, err.get_sense());
-      std::exit(EXIT_FAILURE);
-    } catch (const std::runtime_error& err) {
-      std::cerr << "stenc: " << err.what() << '\n';
+    case stenc::check_result::mismatch:
+      std::exit(CHECK_EXIT_MISMATCH);
+    case stenc::check_result::no_media:
+      std::exit(CHECK_EXIT_NO_MEDIA);
+    default:
       std::exit(EXIT_FAILURE);
     }
   }
 
+  if (watch_interval) {
+    watch_drives(drives, *watch_interval, watch_events, lock_timeout, gentle);
+  }
+
+  if (!enc_mode && !dec_mode) {
+    if (table_format) {
+      auto states {for_each_device<stenc::drive_state>(
+          drives, [lock_timeout, gentle](const stenc::drive_paths& drive,
+                                         stenc::drive_state& state) {
+            query_drive(drive, lock_timeout, gentle, state);
+          })};
+      if (table_filter) {
+        std::vector<stenc::drive_state> selected;
+        for (auto i: stenc::fleet_state {states}.select(*table_filter)) {
+          selected.push_back(states[i]);
+        }
+        print_table(std::cout, selected, table_column_list, table_sort);
+      } else {
+        print_table(std::cout, states, table_column_list, table_sort);
+      }
+      bool ok {true};
+      for (const auto& state: states) {
+        if (!state.error.empty()) {
+          std::cerr << "stenc: " << state.device << ": " << state.error
+                    << '\n';
+          ok = false;
+        }
+      }
+      std::exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    auto reports {for_each_device<device_report>(
+        drives, [lock_timeout, gentle](const stenc::drive_paths& drive,
+                                       device_report& report) {
+          auto ok {on_drive(
+              drive, report.err, [&](const std::string& device) {
+                query_status(device, lock_timeout, report, gentle);
+              })};
+          report.ok = report.ok && ok;
+        })};
+
+    bool ok {true};
+    for (std::size_t i = 0; i < reports.size(); i++) {
+      if (i > 0) {
+        std::cout.put('\n');
+      }
+      std::cout << reports[i].out.str();
+      if (!reports[i].dec_page.empty()) {
+        // drives of one model report identical capabilities; list them once
+        auto same {std::find_if(reports.begin(), reports.begin() + i,
+                                [&](const device_report& r) {
+                                  return r.dec_page == reports[i].dec_page;
+                                })};
+        if (same != reports.begin() + i) {
+          std::cout << std::left << std::setw(25) << "Supported algorithms:"
+                    << "same as " << same->device
+                    << '\n';
+        } else {
+          scsi::print_algorithms(
+              std::cout, reinterpret_cast<const scsi::page_dec&>(
+                             *reports[i].dec_page.data()));
+        }
+      }
+      std::cerr << reports[i].err.str();
+      ok = ok && reports[i].ok;
+    }
+    std::exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
   // Infer encrypt/decrypt mode when only one is specified
   if (enc_mode && !dec_mode) {
     if (enc_mode == scsi::encrypt_mode::off) {
@@ -550,6 +1431,10 @@ int main(int argc, char **argv)
     }
   }
 
+  openlog("stenc", LOG_CONS, LOG_USER);
+  arena.emplace(3u + MAX_PARALLEL_DEVICES);
+  key = arena->acquire();
+
   if (enc_mode != scsi::encrypt_mode::off ||
       dec_mode != scsi::decrypt_mode::off) {
     if (keyFile.empty()) {
@@ -557,169 +1442,151 @@ int main(int argc, char **argv)
       std::exit(EXIT_FAILURE);
     }
 
-    // set keyInput here
-    std::string keyInput;
+    auto key_text {arena->acquire()};
+    std::optional<std::size_t> key_text_length;
 
     if (keyFile == "-"s) { // Read key file from standard input
       if (isatty(STDIN_FILENO)) {
-        std::cout << "Enter key in hex format (input will be hidden): ";
+        std::cout << "Enter key in hex format (input will be hidden): "
+                  << std::flush;
         echo(false);
       }
-      std::getline(std::cin, keyInput);
+      key_text_length =
+          read_line(STDIN_FILENO, reinterpret_cast<char *>(key_text.data()),
+                    stenc::key_slot::capacity);
       if (isatty(STDIN_FILENO)) {
-        std::cout << "\nEnter key descriptor (optional): ";
+        std::cout << "\nEnter key descriptor (optional): " << std::flush;
         echo(true);
       }
       std::getline(std::cin, key_name);
     } else {
-      std::ifstream myfile {keyFile};
-      if (!myfile.is_open()) {
-        std::cerr << "stenc: Cannot open " << keyFile << ": " << strerror(errno)
-                  << '\n';
+      int fd {open(keyFile.c_str(), O_RDONLY | O_CLOEXEC)};
+      if (fd == -1) {
+        auto err {errno};
+        std::cerr << "stenc: Cannot open " << keyFile << ": "
+                  << std::generic_category().message(err) << '\n';
         std::exit(EXIT_FAILURE);
       }
-      std::getline(myfile, keyInput);
-      std::getline(myfile, key_name);
-    }
-
-    if (auto key_bytes = key_from_hex_chars(keyInput)) {
-      key = *key_bytes;
-    } else {
-      std::cerr << "stenc: Invalid key in key file\n";
-      std::exit(EXIT_FAILURE);
-    }
-  }
-
-  try {
-    scsi::get_dec(tapeDrive, buffer, sizeof(buffer));
-    auto& dec_page {reinterpret_cast<const scsi::page_dec&>(buffer)};
-    auto algorithms {scsi::read_algorithms(dec_page)};
-
-    if (algorithm_index == std::nullopt) {
-      if (algorithms.size() == 1) {
-        // Pick the only available algorithm if not specified
-        const scsi::algorithm_descriptor& ad = algorithms[0];
-        std::cerr << "Algorithm index not specified, using " << std::dec
-                  << static_cast<unsigned int>(ad.algorithm_index) << " (";
-        print_algorithm_name(std::cerr, ntohl(ad.security_algorithm_code));
-        std::cerr << ")\n";
-        algorithm_index = ad.algorithm_index;
-      } else {
-        std::cerr << "stenc: Algorithm index not specified\n";
-        print_algorithms(std::cerr, dec_page);
+      key_text_length =
+          read_line(fd, reinterpret_cast<char *>(key_text.data()),
+                    stenc::key_slot::capacity);
+      char name[512];
+      auto name_length {read_line(fd, name, sizeof(name))};
+      close(fd);
+      if (!name_length) {
+        key_text.release();
+        std::cerr << "stenc: Invalid key descriptor in key file\n";
         std::exit(EXIT_FAILURE);
       }
+      key_name.assign(name, *name_length);
     }
 
-    auto algo_it {
-        std::find_if(algorithms.begin(), algorithms.end(),
-                     [algorithm_index](const scsi::algorithm_descriptor& ad) {
-                       return ad.algorithm_index == algorithm_index;
-                     })};
-    if (algo_it == algorithms.end()) {
-      std::cerr << "stenc: Algorithm index " << std::dec
-                << static_cast<unsigned int>(*algorithm_index)
-                << " not supported by device\n";
-      std::exit(EXIT_FAILURE);
+    std::optional<std::size_t> key_length;
+    if (key_text_length) {
+      key_length = key_from_hex_chars(
+          reinterpret_cast<const char *>(key_text.data()), *key_text_length,
+          key.data(), stenc::key_slot::capacity);
     }
-    const scsi::algorithm_descriptor& ad = *algo_it;
-
-    auto encrypt_c {static_cast<unsigned int>(
-        ad.flags1 & scsi::algorithm_descriptor::flags1_encrypt_c_mask)};
-    if (enc_mode != scsi::encrypt_mode::off &&
-        encrypt_c != 2u << scsi::algorithm_descriptor::flags1_encrypt_c_pos) {
-      std::cerr
-          << "stenc: Device does not support encryption using algorithm index "
-          << std::dec << static_cast<unsigned int>(*algorithm_index) << '\n';
-      std::exit(EXIT_FAILURE);
-    }
-
-    auto decrypt_c {static_cast<unsigned int>(
-        ad.flags1 & scsi::algorithm_descriptor::flags1_decrypt_c_mask)};
-    if (dec_mode != scsi::decrypt_mode::off &&
-        decrypt_c != 2u << scsi::algorithm_descriptor::flags1_decrypt_c_pos) {
-      std::cerr
-          << "stenc: Device does not support decryption using algorithm index "
-          << std::dec << static_cast<unsigned int>(*algorithm_index) << '\n';
-      std::exit(EXIT_FAILURE);
-    }
-
-    if ((enc_mode != scsi::encrypt_mode::off ||
-         dec_mode != scsi::decrypt_mode::off) &&
-        key.size() != ntohs(ad.key_length)) {
-      std::cerr << "stenc: Incorrect key size, expected " << std::dec
-                << ntohs(ad.key_length) << " bytes, got " << key.size() << '\n';
-      std::exit(EXIT_FAILURE);
-    }
-
-    if (key_name.size() > ntohs(ad.maximum_ukad_length)) {
-      std::cerr << "stenc: Key descriptor exceeds maximum length of "
-                << std::dec << ntohs(ad.maximum_ukad_length) << " bytes\n";
+    key_text.release();
+    if (!key_length) {
+      std::cerr << "stenc: Invalid key in key file\n";
       std::exit(EXIT_FAILURE);
     }
+    key.resize(*key_length);
+  }
 
-    bool ukad_fixed =
-        (ad.flags2 & scsi::algorithm_descriptor::flags2_ukadf_mask) ==
-        scsi::algorithm_descriptor::flags2_ukadf_mask;
-    if (ukad_fixed && key_name.size() < ntohs(ad.maximum_ukad_length)) {
-      // Pad key descriptor to required length
-      key_name.resize(ntohs(ad.maximum_ukad_length), ' ');
-    }
-
-    if ((ad.flags2 & scsi::algorithm_descriptor::flags2_kadf_c_mask) ==
-        scsi::algorithm_descriptor::flags2_kadf_c_mask) {
-      kad_format =
-          scsi::kadf::ascii_key_name; // set KAD format field if allowed
-    }
-
-    if (enc_mode != scsi::encrypt_mode::on) {
-      // key descriptor only valid when key is used for writing
-      key_name.erase();
+  bool ok {true};
+  {
+    const auto all_hosts {scsi::nexus_scope::all_it_nexus};
+    // the scope given on the command line, or else by the policy rule for
+    // the drive, or else by the rule for the tape
+    const auto scope_of {[&](const stenc::drive_paths& drive) {
+      if (!scope && key_policy) {
+        for (const auto& path: drive.paths) {
+          if (auto rule {key_policy->match(stenc::policy_key::drive, path)}) {
+            return *rule->settings.scope;
+          }
+        }
+      }
+      return scope.value_or(tape_scope.value_or(all_hosts));
+    }};
+    const auto make_settings {[&](stenc::key_slot slot,
+                                  scsi::nexus_scope drive_scope) {
+      return stenc::encryption_settings {
+          enc_mode.value(), dec_mode.value(), algorithm_index, std::move(slot),
+          key_name,         rdmc,             ckod,            ckorp,
+          ckorl,            reservation_wait, drive_scope};
+    }};
+    const stenc::encryption_settings settings {
+        make_settings(std::move(key), scope_of(drives.front()))};
+    // drive rules may give other drives the other scope, whose settings
+    // need a copy of the key
+    std::optional<stenc::encryption_settings> other_settings;
+    for (const auto& drive: drives) {
+      if (auto drive_scope {scope_of(drive)};
+          drive_scope != settings.scope && !other_settings) {
+        auto copy {arena->acquire()};
+        copy.resize(settings.key.size());
+        std::copy_n(settings.key.data(), settings.key.size(), copy.data());
+        other_settings = make_settings(std::move(copy), drive_scope);
+      }
     }
+    const auto settings_for {[&](const stenc::drive_paths& drive)
+                                 -> const stenc::encryption_settings& {
+      return scope_of(drive) == settings.scope ? settings : *other_settings;
+    }};
+    const auto audit {[](const std::string& record) {
+      syslog(LOG_NOTICE, "%s", record.c_str());
+    }};
 
-    if (rdmc != scsi::sde_rdmc {}) {
-      auto rdmc_c {static_cast<unsigned int>(
-          ad.flags3 & scsi::algorithm_descriptor::flags3_rdmc_c_mask)};
-      if (rdmc_c == 6u << scsi::algorithm_descriptor::flags3_rdmc_c_pos ||
-          rdmc_c == 7u << scsi::algorithm_descriptor::flags3_rdmc_c_pos) {
-        std::cerr << "stenc: Device does not allow control of raw reads\n";
-        std::exit(EXIT_FAILURE);
+    if (spread) {
+      // one drive at a time, leaving busy drives until they are idle
+      auto outcomes {stenc::spread_changes(
+          drives.size(), {*spread, SPREAD_RETRY_INTERVAL},
+          [&](std::size_t i) {
+            return stenc::is_drive_busy(drives[i].paths.front());
+          },
+          [&](std::size_t i) {
+            std::ostringstream err;
+            auto outcome {stenc::change_outcome::failed};
+            on_drive(drives[i], err, [&](const std::string& device) {
+              outcome = stenc::ensure_encryption(device, settings_for(drives[i]),
+                                                 *arena, lock_timeout, err,
+                                                 audit, hooks);
+            });
+            std::cerr << err.str();
+            return outcome;
+          },
+          [&](const std::string& message) {
+            audit(message);
+            std::cerr << message << '\n';
+          })};
+      for (std::size_t i = 0; i < outcomes.size(); i++) {
+        if (outcomes[i] == stenc::change_outcome::deferred) {
+          std::cerr << "stenc: " << drives[i].paths.front()
+                    << " stayed busy, not changed\n";
+        }
+        ok = ok && (outcomes[i] == stenc::change_outcome::changed ||
+                    outcomes[i] == stenc::change_outcome::unchanged);
       }
-    }
+    } else {
+      auto reports {for_each_device<device_report>(
+          drives, [&](const stenc::drive_paths& drive, device_report& report) {
+            auto ok {on_drive(
+                drive, report.err, [&](const std::string& device) {
+                  report.ok = stenc::set_encryption(
+                      device, settings_for(drive), *arena, lock_timeout,
+                      report.err, audit, hooks);
+                })};
+            report.ok = report.ok && ok;
+          })};
 
-    if (ckod && !scsi::is_device_ready(tapeDrive)) {
-      std::cerr << "stenc: Cannot use --ckod when no tape media is loaded\n";
-      std::exit(EXIT_FAILURE);
+      for (const auto& report: reports) {
+        std::cerr << report.err.str();
+        ok = ok && report.ok;
+      }
     }
-
-    // Write the options to the tape device
-    std::cerr << "Changing encryption settings for device " << tapeDrive
-              << "...\n";
-    auto sde_buffer {scsi::make_sde(enc_mode.value(), dec_mode.value(),
-                                    algorithm_index.value(), key, key_name,
-                                    kad_format, rdmc, ckod)};
-    scsi::write_sde(tapeDrive, sde_buffer.get());
-    scsi::get_des(tapeDrive, buffer, sizeof(buffer));
-    auto& opt {reinterpret_cast<const scsi::page_des&>(buffer)};
-    std::ostringstream oss;
-
-    oss << "Encryption settings changed for device " << tapeDrive
-        << ": mode: encrypt = " << enc_mode.value()
-        << ", decrypt = " << dec_mode.value() << '.';
-    if (!key_name.empty()) {
-      oss << " Key Descriptor: '" << key_name << "',";
-    }
-    oss << " Key Instance Counter: " << std::dec
-        << ntohl(opt.key_instance_counter) << '\n';
-    syslog(LOG_NOTICE, "%s", oss.str().c_str());
-    std::cerr << "Success! See system logs for a key change audit log.\n";
-  } catch (const scsi::scsi_error& err) {
-    std::cerr << "stenc: " << err.what() << '\n';
-    scsi::print_sense_data(std::cerr, err.get_sense());
-    std::exit(EXIT_FAILURE);
-  } catch (const std::runtime_error& err) {
-    std::cerr << "stenc: " << err.what() << '\n';
-    std::exit(EXIT_FAILURE);
-  }
+  } // key is wiped here, std::exit does not run destructors
+  std::exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 #endif // defined(CATCH_CONFIG_MAIN)
@@ -0,0 +1,127 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+#include <dirent.h>
+
+#include "multipath.h"
+
+namespace stenc {
+
+struct dir_closer {
+  void operator()(DIR *d) const noexcept { closedir(d); }
+};
+
+// whether name is prefix followed by a unit number
+static bool is_unit(const std::string& name, const std::string& prefix)
+{
+  return name.size() > prefix.size() &&
+         name.compare(0, prefix.size(), prefix) == 0 &&
+         std::all_of(name.begin() + prefix.size(), name.end(),
+                     [](unsigned char c) { return std::isdigit(c); });
+}
+
+std::vector<std::string> discover_devices()
+{
+#if defined(OS_LINUX)
+  // generic SCSI nodes exist for every path, unlike st nodes which may be
+  // missing when the st driver is not loaded
+  const std::string dir {"/sys/class/scsi_generic"};
+  const std::string prefix {"sg"};
+#elif defined(OS_FREEBSD)
+  const std::string dir {"/dev"};
+  const std::string prefix {"nsa"};
+#endif
+  std::vector<std::string> names;
+
+  std::unique_ptr<DIR, dir_closer> d {opendir(dir.c_str())};
+  if (d == nullptr) {
+    return {};
+  }
+  while (auto entry {readdir(d.get())}) {
+    std::string name {entry->d_name};
+    if (!is_unit(name, prefix)) {
+      continue;
+    }
+#if defined(OS_LINUX)
+    int type {-1};
+    std::ifstream {dir + '/' + name + "/device/type"} >> type;
+    if (type != 1) { // sequential-access device
+      continue;
+    }
+#endif
+    names.push_back(name);
+  }
+
+  std::sort(names.begin(), names.end(),
+            [&prefix](const std::string& lhs, const std::string& rhs) {
+              return std::stoul(lhs.substr(prefix.size())) <
+                     std::stoul(rhs.substr(prefix.size()));
+            });
+  std::vector<std::string> devices;
+  for (const auto& name: names) {
+    devices.push_back("/dev/" + name);
+  }
+  return devices;
+}
+
+path_probe probe_path(const std::string& device)
+{
+  alignas(4) std::uint8_t buffer[512] {};
+  path_probe probe {};
+
+  probe.device = device;
+  try {
+    auto start {std::chrono::steady_clock::now()};
+    scsi::get_device_identification(device, buffer, sizeof(buffer));
+    probe.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    probe.identifier = scsi::logical_unit_designator(buffer, sizeof(buffer));
+  } catch (const std::runtime_error&) {
+    // reported when the device is used
+  }
+  return probe;
+}
+
+std::vector<drive_paths> group_paths(const std::vector<path_probe>& probes)
+{
+  std::vector<drive_paths> drives;
+  std::vector<std::vector<const path_probe *>> members;
+
+  for (const auto& probe: probes) {
+    auto it {probe.identifier.empty()
+                 ? drives.end()
+                 : std::find_if(drives.begin(), drives.end(),
+                                [&probe](const drive_paths& drive) {
+                                  return drive.identifier == probe.identifier;
+                                })};
+    if (it == drives.end()) {
+      drives.push_back({probe.identifier, {}});
+      members.emplace_back();
+      it = drives.end() - 1;
+    }
+    members[it - drives.begin()].push_back(&probe);
+  }
+
+  for (std::size_t i = 0; i < drives.size(); i++) {
+    std::stable_sort(members[i].begin(), members[i].end(),
+                     [](const path_probe *lhs, const path_probe *rhs) {
+                       return lhs->latency < rhs->latency;
+                     });
+    for (auto probe: members[i]) {
+      drives[i].paths.push_back(probe->device);
+    }
+  }
+  return drives;
+}
+
+} // namespace stenc
@@ -0,0 +1,72 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+Drives with several ports are seen once per path. Paths are grouped by the
+logical unit designator of the drive, so that each drive is handled once,
+through its fastest path, falling back to other paths on transport errors.
+*/
+
+#ifndef _MULTIPATH_H
+#define _MULTIPATH_H
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "scsiencrypt.h"
+
+namespace stenc {
+
+// Result of identifying the drive behind one device node
+struct path_probe {
+  std::string device;
+  // logical unit designator, empty if the drive could not be identified
+  std::string identifier;
+  // time taken by the identification command
+  std::chrono::microseconds latency {};
+};
+
+// All paths to one drive, fastest first
+struct drive_paths {
+  std::string identifier;
+  std::vector<std::string> paths;
+};
+
+// List the SCSI tape devices present on the system, one per path
+std::vector<std::string> discover_devices();
+
+// Identify the drive behind device and time the command. Does not throw.
+path_probe probe_path(const std::string& device);
+
+// Group probed paths by identifier, in order of first appearance. Paths of
+// a drive are ordered by latency. Unidentified devices form groups of their
+// own.
+std::vector<drive_paths> group_paths(const std::vector<path_probe>& probes);
+
+// Run op(path) on the first path of drive, moving on to the next path when
+// it throws scsi::transport_error. Returns false, with the errors written
+// to err, if no path worked. op must not throw scsi::transport_error once
+// it has changed the drive, unless doing it again is harmless.
+template <typename Operation>
+bool with_failover(const drive_paths& drive, std::ostream& err, Operation op)
+{
+  for (auto it {drive.paths.begin()}; it != drive.paths.end(); ++it) {
+    try {
+      op(*it);
+      return true;
+    } catch (const scsi::transport_error& e) {
+      err << "stenc: " << e.what() << '\n';
+      if (it + 1 != drive.paths.end()) {
+        err << "Retrying through " << *(it + 1) << '\n';
+      }
+    }
+  }
+  return false;
+}
+
+} // namespace stenc
+
+#endif
@@ -0,0 +1,618 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <algorithm>
+#include <charconv>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+
+#include "activity.h"
+#include "devlock.h"
+#include "operations.h"
+#include "quirks.h"
+
+namespace stenc {
+
+// Run command, retrying while another initiator holds a reservation on the
+// device until it is released or wait has passed. The device lock is held
+// meanwhile, so local invocations queue up behind the first one to wait.
+template <typename Command>
+static void retry_on_conflict(Command command, std::chrono::milliseconds wait,
+                              const std::string& device, std::ostream& err)
+{
+  const auto deadline {std::chrono::steady_clock::now() + wait};
+  std::chrono::milliseconds delay {100};
+
+  for (bool waiting {};; waiting = true) {
+    try {
+      command();
+      return;
+    } catch (const scsi::reservation_conflict&) {
+      const auto now {std::chrono::steady_clock::now()};
+      if (now >= deadline) {
+        throw;
+      }
+      if (!waiting) {
+        err << "Waiting for reservation on " << device
+            << " to be released...\n";
+      }
+      std::this_thread::sleep_for(
+          std::min<std::chrono::steady_clock::duration>(delay, deadline - now));
+      delay = std::min(delay * 2, std::chrono::milliseconds {5000});
+    }
+  }
+}
+
+// Report who holds the reservation that caused a conflict, as far as
+// PERSISTENT RESERVE IN can tell
+static void print_conflict(const std::string& device,
+                           const scsi::reservation_conflict& e,
+                           std::ostream& err)
+{
+  err << "stenc: " << device << ": " << e.what() << '\n';
+  try {
+    scsi::print_reservation(err, scsi::get_reservation(device));
+  } catch (const std::runtime_error&) {
+    // drive does not support persistent reservations
+  }
+}
+
+void query_state(const std::string& device,
+                 std::chrono::milliseconds lock_timeout, drive_state& state,
+                 bool gentle)
+{
+  alignas(4) scsi::page_buffer buffer {};
+  std::chrono::steady_clock::time_point start {};
+  const bool busy {gentle && is_drive_busy(device)};
+
+  state.device = device;
+  try {
+    device_lock lock {device, lock_mode::shared, lock_timeout};
+    start = std::chrono::steady_clock::now();
+    decode_inquiry(state, scsi::get_inquiry(device));
+    const auto& quirks {
+        find_quirks(state.vendor, state.product, state.revision)};
+    scsi::get_des(device, buffer, sizeof(buffer));
+    decode_des(state, reinterpret_cast<const scsi::page_des&>(buffer));
+    if (busy) {
+      state.volume = volume_state::busy;
+    } else if (quirks.no_nbes) {
+      // as for the device status, the volume is left unknown without the
+      // TEST UNIT READY that would only tell whether media is loaded
+    } else if (scsi::is_device_ready(device)) {
+      try {
+        scsi::get_nbes(device, buffer, sizeof(buffer));
+        decode_nbes(state, reinterpret_cast<const scsi::page_nbes&>(buffer));
+      } catch (const scsi::scsi_error& err) {
+        if (!quirks.nbes_blank_check ||
+            err.sense().sense_key() != scsi::sense_data::blank_check) {
+          throw;
+        }
+      }
+    } else {
+      state.volume = volume_state::no_media;
+    }
+  } catch (const scsi::transport_error&) {
+    throw;
+  } catch (const std::runtime_error& err) {
+    state.error = err.what();
+  }
+  if (start != std::chrono::steady_clock::time_point {}) {
+    state.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+  }
+}
+
+// Apply settings to device, whose lock the caller holds. media_loaded
+// saves the TEST UNIT READY for --ckod when the caller already knows that
+// media is loaded. The settings read back afterwards for the audit record
+// are left in buffer.
+static bool apply_settings(const std::string& device,
+                           const encryption_settings& settings,
+                           key_arena& arena, std::ostream& err,
+                           const audit_sink& audit, const change_hooks& hooks,
+                           bool media_loaded, scsi::page_buffer& buffer)
+{
+  auto algorithm_index {settings.algorithm_index};
+  auto key_name {settings.key_name};
+  scsi::kadf kad_format {};
+  drive_state before {};
+  if (hooks.pre || hooks.post) {
+    before.device = device;
+    decode_inquiry(before, scsi::get_inquiry(device));
+  }
+  // the hooks read the INQUIRY data anyway
+  const auto& quirks {hooks.pre || hooks.post
+                          ? find_quirks(before.vendor, before.product,
+                                        before.revision)
+                          : device_quirks(device)};
+
+  retry_on_conflict(
+      [&] { scsi::get_dec(device, buffer, sizeof(buffer)); },
+      settings.reservation_wait, device, err);
+  auto& dec_page {reinterpret_cast<const scsi::page_dec&>(buffer)};
+  auto algorithms {scsi::read_algorithms(dec_page)};
+
+  if (algorithm_index == std::nullopt) {
+    if (algorithms.size() == 1) {
+      // Pick the only available algorithm if not specified
+      const scsi::algorithm_descriptor& ad = algorithms[0];
+      err << "Algorithm index not specified, using " << std::dec
+          << static_cast<unsigned int>(ad.algorithm_index) << " (";
+      scsi::print_algorithm_name(err, ntohl(ad.security_algorithm_code));
+      err << ")\n";
+      algorithm_index = ad.algorithm_index;
+    } else {
+      err << "stenc: Algorithm index not specified\n";
+      scsi::print_algorithms(err, dec_page);
+      return false;
+    }
+  }
+
+  auto algo_it {
+      std::find_if(algorithms.begin(), algorithms.end(),
+                   [algorithm_index](const scsi::algorithm_descriptor& ad) {
+                     return ad.algorithm_index == algorithm_index;
+                   })};
+  if (algo_it == algorithms.end()) {
+    err << "stenc: Algorithm index " << std::dec
+        << static_cast<unsigned int>(*algorithm_index)
+        << " not supported by device\n";
+    return false;
+  }
+  const scsi::algorithm_descriptor& ad = *algo_it;
+
+  auto encrypt_c {static_cast<unsigned int>(
+      ad.flags1 & scsi::algorithm_descriptor::flags1_encrypt_c_mask)};
+  if (settings.enc_mode != scsi::encrypt_mode::off &&
+      encrypt_c != 2u << scsi::algorithm_descriptor::flags1_encrypt_c_pos) {
+    err << "stenc: Device does not support encryption using algorithm index "
+        << std::dec << static_cast<unsigned int>(*algorithm_index) << '\n';
+    return false;
+  }
+
+  auto decrypt_c {static_cast<unsigned int>(
+      ad.flags1 & scsi::algorithm_descriptor::flags1_decrypt_c_mask)};
+  if (settings.dec_mode != scsi::decrypt_mode::off &&
+      decrypt_c != 2u << scsi::algorithm_descriptor::flags1_decrypt_c_pos) {
+    err << "stenc: Device does not support decryption using algorithm index "
+        << std::dec << static_cast<unsigned int>(*algorithm_index) << '\n';
+    return false;
+  }
+
+  if ((settings.enc_mode != scsi::encrypt_mode::off ||
+       settings.dec_mode != scsi::decrypt_mode::off) &&
+      settings.key.size() != ntohs(ad.key_length)) {
+    err << "stenc: Incorrect key size, expected " << std::dec
+        << ntohs(ad.key_length) << " bytes, got " << settings.key.size()
+        << '\n';
+    return false;
+  }
+
+  if (key_name.size() > ntohs(ad.maximum_ukad_length)) {
+    err << "stenc: Key descriptor exceeds maximum length of " << std::dec
+        << ntohs(ad.maximum_ukad_length) << " bytes\n";
+    return false;
+  }
+
+  bool ukad_fixed =
+      (ad.flags2 & scsi::algorithm_descriptor::flags2_ukadf_mask) ==
+      scsi::algorithm_descriptor::flags2_ukadf_mask;
+  if ((ukad_fixed || quirks.pad_ukad) &&
+      key_name.size() < ntohs(ad.maximum_ukad_length)) {
+    // Pad key descriptor to required length
+    key_name.resize(ntohs(ad.maximum_ukad_length), ' ');
+  }
+
+  if ((ad.flags2 & scsi::algorithm_descriptor::flags2_kadf_c_mask) ==
+      scsi::algorithm_descriptor::flags2_kadf_c_mask) {
+    kad_format =
+        scsi::kadf::ascii_key_name; // set KAD format field if allowed
+  }
+
+  if (settings.enc_mode != scsi::encrypt_mode::on) {
+    // key descriptor only valid when key is used for writing
+    key_name.erase();
+  }
+
+  if (settings.rdmc != scsi::sde_rdmc {}) {
+    auto rdmc_c {static_cast<unsigned int>(
+        ad.flags3 & scsi::algorithm_descriptor::flags3_rdmc_c_mask)};
+    if (quirks.no_rdmc ||
+        rdmc_c == 6u << scsi::algorithm_descriptor::flags3_rdmc_c_pos ||
+        rdmc_c == 7u << scsi::algorithm_descriptor::flags3_rdmc_c_pos) {
+      err << "stenc: Device does not allow control of raw reads\n";
+      return false;
+    }
+  }
+
+  if (settings.ckod && !media_loaded && !scsi::is_device_ready(device)) {
+    err << "stenc: Cannot use --ckod when no tape media is loaded\n";
+    return false;
+  }
+
+  if (hooks.pre || hooks.post) {
+    scsi::get_des(device, buffer, sizeof(buffer));
+    decode_des(before, reinterpret_cast<const scsi::page_des&>(buffer));
+  }
+  if (hooks.pre && !hooks.pre(before, key_name, err)) {
+    err << "stenc: Change on " << device << " cancelled by hook\n";
+    return false;
+  }
+
+  // Write the options to the tape device
+  err << "Changing encryption settings for device " << device << "...\n";
+  auto sde_buffer {arena.acquire()};
+  sde_buffer.resize(scsi::make_sde(
+      sde_buffer.data(), key_slot::capacity, settings.enc_mode,
+      settings.dec_mode, algorithm_index.value(), settings.key.data(),
+      settings.key.size(), key_name, kad_format, settings.rdmc,
+      settings.ckod, settings.ckorp, settings.ckorl, settings.scope));
+  std::ostringstream oss;
+  oss << "Encryption settings changed for device " << device
+      << ": mode: encrypt = " << settings.enc_mode
+      << ", decrypt = " << settings.dec_mode << '.';
+  if (!key_name.empty()) {
+    oss << " Key Descriptor: '" << key_name << "',";
+  }
+  if (settings.scope == scsi::nexus_scope::local) {
+    oss << " Key Scope: local,";
+  }
+  // Once the SPOUT has been issued, a transport error must not have the
+  // caller fail over and send it again through another path, which would
+  // change the key twice, or with local scope set it on a second I_T nexus.
+  // It is audited and reported as a failure instead.
+  try {
+    retry_on_conflict(
+        [&] {
+          scsi::write_sde(device, sde_buffer.data(), quirks.sde_timeout);
+        },
+        settings.reservation_wait, device, err);
+  } catch (const scsi::transport_error& e) {
+    audit(oss.str() + " Key Instance Counter: unknown, the change may not "
+                      "have reached the device\n");
+    throw std::runtime_error {e.what()};
+  }
+  sde_buffer.release();
+  try {
+    scsi::get_des(device, buffer, sizeof(buffer));
+  } catch (const scsi::transport_error& e) {
+    audit(oss.str() + " Key Instance Counter: unknown\n");
+    throw std::runtime_error {e.what()};
+  }
+  auto& opt {reinterpret_cast<const scsi::page_des&>(buffer)};
+
+  oss << " Key Instance Counter: " << std::dec
+      << ntohl(opt.key_instance_counter) << '\n';
+  audit(oss.str());
+  if (hooks.post) {
+    auto after {before};
+    decode_des(after, opt);
+    hooks.post(before, after, key_name, err);
+  }
+  err << "Success! See system logs for a key change audit log.\n";
+  return true;
+}
+
+static void warn_unlocked(const device_lock& lock, std::ostream& err)
+{
+  if (!lock.held()) {
+    err << "stenc: Cannot use lock files in " LOCK_DIR
+           ", continuing without locking\n";
+  }
+}
+
+bool set_encryption(const std::string& device,
+                    const encryption_settings& settings, key_arena& arena,
+                    std::chrono::milliseconds lock_timeout, std::ostream& err,
+                    const audit_sink& audit, const change_hooks& hooks)
+{
+  alignas(4) scsi::page_buffer buffer {};
+
+  try {
+    // hold the lock from reading capabilities until the new settings have
+    // been read back, so the audit log reflects this invocation's change
+    device_lock lock {device, lock_mode::exclusive, lock_timeout};
+    warn_unlocked(lock, err);
+    return apply_settings(device, settings, arena, err, audit, hooks, false,
+                          buffer);
+  } catch (const scsi::transport_error&) {
+    throw;
+  } catch (const scsi::reservation_conflict& e) {
+    print_conflict(device, e, err);
+  } catch (const scsi::scsi_error& e) {
+    err << "stenc: " << e.what() << '\n';
+    scsi::print_sense_data(err, e.sense());
+  } catch (const std::runtime_error& e) {
+    err << "stenc: " << e.what() << '\n';
+  }
+  return false;
+}
+
+// The state settings leave a device in, as far as it can be read back
+static drive_expectation expectation_of(const encryption_settings& settings)
+{
+  drive_expectation expected;
+  expected.enc_mode = settings.enc_mode;
+  expected.dec_mode = settings.dec_mode;
+  // devices may report any algorithm and scope with encryption off
+  if (settings.enc_mode != scsi::encrypt_mode::off ||
+      settings.dec_mode != scsi::decrypt_mode::off) {
+    expected.algorithm_index = settings.algorithm_index;
+    expected.scope = settings.scope;
+  }
+  if (settings.enc_mode == scsi::encrypt_mode::on &&
+      !settings.key_name.empty()) {
+    expected.key_name = settings.key_name;
+  }
+  return expected;
+}
+
+change_outcome ensure_encryption(const std::string& device,
+                                 const encryption_settings& settings,
+                                 key_arena& arena,
+                                 std::chrono::milliseconds lock_timeout,
+                                 std::ostream& err, const audit_sink& audit,
+                                 const change_hooks& hooks)
+{
+  const auto expected {expectation_of(settings)};
+  // a key is always sent, since a new key may be rotated in under the
+  // descriptor of the old one; only settings without a key can be skipped
+  const bool skippable {!settings.key};
+
+  alignas(4) scsi::page_buffer buffer {};
+  auto& des {reinterpret_cast<const scsi::page_des&>(buffer)};
+
+  try {
+    // one lock and one DES on either side of the change, the second of
+    // which is the one read back for the audit record
+    device_lock lock {device, lock_mode::exclusive, lock_timeout};
+    warn_unlocked(lock, err);
+    bool media_loaded {};
+    // the DES before the change is only needed to skip the change, or to
+    // spare the TEST UNIT READY for ckod
+    if (skippable || settings.ckod) {
+      scsi::get_des(device, buffer, sizeof(buffer));
+      if (skippable && des_matches(des, expected)) {
+        err << "Device " << device << " already has the requested settings\n";
+        return change_outcome::unchanged;
+      }
+      // only a mounted volume can contain encrypted blocks
+      media_loaded = (des.flags & scsi::page_des::flags_vcelb_mask) !=
+                     std::byte {};
+    }
+    if (!apply_settings(device, settings, arena, err, audit, hooks,
+                        media_loaded, buffer)) {
+      return change_outcome::failed;
+    }
+    if (!des_matches(des, expected)) {
+      err << "stenc: Settings read back from " << device
+          << " differ from the settings applied\n";
+      return change_outcome::failed;
+    }
+    return change_outcome::changed;
+  } catch (const scsi::transport_error&) {
+    throw;
+  } catch (const scsi::reservation_conflict& e) {
+    print_conflict(device, e, err);
+  } catch (const scsi::scsi_error& e) {
+    err << "stenc: " << e.what() << '\n';
+    scsi::print_sense_data(err, e.sense());
+  } catch (const std::runtime_error& e) {
+    err << "stenc: " << e.what() << '\n';
+  }
+  return change_outcome::failed;
+}
+
+bool purge_key(const std::string& device, std::ostream& err,
+               const audit_sink& audit)
+{
+  alignas(4) scsi::page_buffer buffer {};
+  alignas(4) scsi::page_buffer sde_buffer {};
+  constexpr std::uint8_t no_key {};
+  drive_expectation cleared;
+  cleared.enc_mode = scsi::encrypt_mode::off;
+  cleared.dec_mode = scsi::decrypt_mode::off;
+  auto write_purge {[&](std::uint8_t algorithm_index) {
+    scsi::make_sde(sde_buffer, sizeof(sde_buffer), scsi::encrypt_mode::off,
+                   scsi::decrypt_mode::off, algorithm_index, &no_key, 0u, {},
+                   {}, {}, false);
+    scsi::write_sde(device, sde_buffer, device_quirks(device).sde_timeout);
+  }};
+
+  // failing over after a transport error clears the key again through
+  // another path, which does no harm
+  try {
+    try {
+      // the algorithm index is ignored with encryption and decryption off
+      write_purge(0u);
+    } catch (const scsi::scsi_error& e) {
+      // unless the drive validates it anyway
+      if (e.sense().sense_key() != scsi::sense_data::illegal_request) {
+        throw;
+      }
+      scsi::get_dec(device, buffer, sizeof(buffer));
+      auto algorithms {scsi::read_algorithms(
+          reinterpret_cast<const scsi::page_dec&>(buffer))};
+      if (algorithms.empty()) {
+        throw;
+      }
+      write_purge(algorithms.front().get().algorithm_index);
+    }
+    scsi::get_des(device, buffer, sizeof(buffer));
+    auto& des {reinterpret_cast<const scsi::page_des&>(buffer)};
+    if (!des_matches(des, cleared)) {
+      err << "stenc: " << device
+          << ": Encryption still enabled after clearing the key\n";
+      return false;
+    }
+    std::ostringstream oss;
+    oss << "Key cleared from device " << device
+        << ": mode: encrypt = off, decrypt = off. Key Instance Counter: "
+        << std::dec << ntohl(des.key_instance_counter) << '\n';
+    audit(oss.str());
+    return true;
+  } catch (const scsi::transport_error&) {
+    throw;
+  } catch (const scsi::reservation_conflict& e) {
+    print_conflict(device, e, err);
+  } catch (const scsi::scsi_error& e) {
+    err << "stenc: " << device << ": " << e.what() << '\n';
+    scsi::print_sense_data(err, e.sense());
+  } catch (const std::runtime_error& e) {
+    err << "stenc: " << device << ": " << e.what() << '\n';
+  }
+  return false;
+}
+
+std::optional<drive_expectation> parse_expectation(const std::string& spec)
+{
+  drive_expectation expected;
+  std::string_view rest {spec};
+
+  while (!rest.empty()) {
+    auto comma {rest.find(',')};
+    auto item {rest.substr(0, comma)};
+    rest = comma == rest.npos ? std::string_view {} : rest.substr(comma + 1);
+
+    auto equals {item.find('=')};
+    if (equals == item.npos) {
+      return {};
+    }
+    auto key {item.substr(0, equals)};
+    auto value {item.substr(equals + 1)};
+
+    if (key == "enc") {
+      if (value == "on") {
+        expected.enc_mode = scsi::encrypt_mode::on;
+      } else if (value == "off") {
+        expected.enc_mode = scsi::encrypt_mode::off;
+      } else {
+        return {};
+      }
+    } else if (key == "dec") {
+      if (value == "on") {
+        expected.dec_mode = scsi::decrypt_mode::on;
+      } else if (value == "off") {
+        expected.dec_mode = scsi::decrypt_mode::off;
+      } else if (value == "mixed") {
+        expected.dec_mode = scsi::decrypt_mode::mixed;
+      } else if (value == "raw") {
+        expected.dec_mode = scsi::decrypt_mode::raw;
+      } else {
+        return {};
+      }
+    } else if (key == "alg") {
+      std::uint8_t index;
+      auto [ptr, ec] {
+          std::from_chars(value.data(), value.data() + value.size(), index)};
+      if (ec != std::errc {} || ptr != value.data() + value.size()) {
+        return {};
+      }
+      expected.algorithm_index = index;
+    } else if (key == "ukad") {
+      expected.key_name = std::string {value};
+    } else if (key == "scope") {
+      if (value == "local") {
+        expected.scope = scsi::nexus_scope::local;
+      } else if (value == "all") {
+        expected.scope = scsi::nexus_scope::all_it_nexus;
+      } else {
+        return {};
+      }
+    } else if (key == "media") {
+      if (value == "yes") {
+        expected.media_loaded = true;
+      } else if (value == "no") {
+        expected.media_loaded = false;
+      } else {
+        return {};
+      }
+    } else {
+      return {};
+    }
+  }
+  return expected;
+}
+
+// drives with fixed length key descriptors return them space padded
+static std::string_view without_padding(std::string_view s)
+{
+  auto end {s.find_last_not_of(' ')};
+  return end == s.npos ? std::string_view {} : s.substr(0, end + 1);
+}
+
+bool des_matches(const scsi::page_des& page, const drive_expectation& expected)
+{
+  if (expected.enc_mode && page.encryption_mode != *expected.enc_mode) {
+    return false;
+  }
+  if (expected.dec_mode && page.decryption_mode != *expected.dec_mode) {
+    return false;
+  }
+  if (expected.algorithm_index &&
+      page.algorithm_index != *expected.algorithm_index) {
+    return false;
+  }
+  if (expected.scope && page.it_nexus_scope() != *expected.scope) {
+    return false;
+  }
+  if (expected.key_name) {
+    std::string_view ukad {};
+    for (const scsi::kad& kd: scsi::read_page_kads(page)) {
+      if (kd.type == scsi::kad_type::ukad) {
+        ukad = {reinterpret_cast<const char *>(kd.descriptor),
+                ntohs(kd.length)};
+      }
+    }
+    if (without_padding(ukad) != without_padding(*expected.key_name)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+check_result check_device(const std::string& device,
+                          const drive_expectation& expected,
+                          std::chrono::milliseconds lock_timeout,
+                          std::ostream& err, bool gentle)
+{
+  alignas(4) scsi::page_buffer buffer {};
+  // a drive doing I/O has media loaded
+  const bool busy {expected.media_loaded && gentle && is_drive_busy(device)};
+
+  try {
+    device_lock lock {device, lock_mode::shared, lock_timeout};
+    scsi::get_des(device, buffer, sizeof(buffer));
+    if (!des_matches(reinterpret_cast<const scsi::page_des&>(buffer),
+                     expected)) {
+      return check_result::mismatch;
+    }
+    if (expected.media_loaded) {
+      auto loaded {busy || scsi::is_device_ready(device)};
+      if (*expected.media_loaded && !loaded) {
+        return check_result::no_media;
+      } else if (!*expected.media_loaded && loaded) {
+        return check_result::mismatch;
+      }
+    }
+    return check_result::match;
+  } catch (const scsi::transport_error&) {
+    throw;
+  } catch (const scsi::reservation_conflict& e) {
+    print_conflict(device, e, err);
+  } catch (const scsi::scsi_error& e) {
+    err << "stenc: " << device << ": " << e.what() << '\n';
+    scsi::print_sense_data(err, e.sense());
+  } catch (const std::runtime_error& e) {
+    err << "stenc: " << device << ": " << e.what() << '\n';
+  }
+  return check_result::error;
+}
+
+} // namespace stenc
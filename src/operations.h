@@ -0,0 +1,147 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+Drive operations built on the SCSI layer. These functions keep no state
+between calls and may be called from several threads at once for different
+drives; messages and audit records go to the sinks passed by the caller.
+scsi::transport_error is thrown rather than reported, so that the caller
+can retry through another path to the drive, except once new settings have
+been sent to the drive, where retrying would send them twice.
+*/
+
+#ifndef _OPERATIONS_H
+#define _OPERATIONS_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+
+#include "drivestate.h"
+#include "keyarena.h"
+#include "scsiencrypt.h"
+
+namespace stenc {
+
+// Encryption settings to apply to a device
+struct encryption_settings {
+  scsi::encrypt_mode enc_mode;
+  scsi::decrypt_mode dec_mode;
+  // chosen automatically if the device supports a single algorithm
+  std::optional<std::uint8_t> algorithm_index;
+  key_slot key;
+  std::string key_name;
+  scsi::sde_rdmc rdmc;
+  bool ckod;
+  // clear key on reservation preempt and on reservation loss
+  bool ckorp;
+  bool ckorl;
+  // how long to wait for another initiator to release its reservation
+  std::chrono::milliseconds reservation_wait;
+  // local scope lets hosts sharing a drive each keep their own key
+  scsi::nexus_scope scope;
+};
+
+// Receives one audit record per successful change of encryption settings
+using audit_sink = std::function<void(const std::string&)>;
+
+// Called around a change of encryption settings with the state of the
+// drive and the key descriptor being set. Messages go to err. A pre hook
+// returning false cancels the change; post hooks run after successful
+// changes only.
+struct change_hooks {
+  std::function<bool(const drive_state& before, const std::string& key_name,
+                     std::ostream& err)>
+      pre;
+  std::function<void(const drive_state& before, const drive_state& after,
+                     const std::string& key_name, std::ostream& err)>
+      post;
+};
+
+// Check settings against the capabilities of device and apply them.
+// Progress and error messages are written to err, including the holder of
+// a reservation that kept the settings from being applied. Returns false if
+// the settings were rejected or could not be applied.
+bool set_encryption(const std::string& device,
+                    const encryption_settings& settings, key_arena& arena,
+                    std::chrono::milliseconds lock_timeout, std::ostream& err,
+                    const audit_sink& audit, const change_hooks& hooks = {});
+
+enum class change_outcome {
+  changed,
+  unchanged, // device already had the settings
+  failed,
+  deferred, // not attempted while the drive was busy
+};
+
+// Like set_encryption, but read the settings back afterwards to verify
+// them. Settings without a key, i.e. encryption and decryption off, are
+// left alone if device already has them; a key is always sent, since
+// whether a device has it cannot be told from its key descriptor. Costs
+// the commands of set_encryption, plus one DES before the change when
+// settings has no key or sets ckod, which spares the TEST UNIT READY for
+// ckod when the volume contains encrypted blocks.
+change_outcome ensure_encryption(const std::string& device,
+                                 const encryption_settings& settings,
+                                 key_arena& arena,
+                                 std::chrono::milliseconds lock_timeout,
+                                 std::ostream& err, const audit_sink& audit,
+                                 const change_hooks& hooks = {});
+
+// Turn encryption and decryption off on device, clearing its key, and
+// verify the change by reading the settings back. Meant for emergencies:
+// the device's capabilities are not checked first, and neither locks held
+// by other stenc processes nor reservations are waited for. Returns false
+// if the key could not be cleared.
+bool purge_key(const std::string& device, std::ostream& err,
+               const audit_sink& audit);
+
+// Query identity, encryption settings and volume status of device. Errors
+// are recorded in state.error. When gentle, the volume status of a drive
+// busy with I/O is not queried, since that takes the drive's attention
+// from the stream.
+void query_state(const std::string& device,
+                 std::chrono::milliseconds lock_timeout, drive_state& state,
+                 bool gentle = false);
+
+// Expected drive state for check_device. Unset fields are not checked.
+struct drive_expectation {
+  std::optional<scsi::encrypt_mode> enc_mode;
+  std::optional<scsi::decrypt_mode> dec_mode;
+  std::optional<std::uint8_t> algorithm_index;
+  std::optional<std::string> key_name;
+  std::optional<bool> media_loaded;
+  std::optional<scsi::nexus_scope> scope;
+};
+
+enum class check_result {
+  match,
+  mismatch,
+  no_media, // media required by the expectation but not loaded
+  error,
+};
+
+// Parse a comma-separated list of KEY=VALUE pairs, where KEY is one of
+// enc, dec, alg, ukad, media or scope
+std::optional<drive_expectation> parse_expectation(const std::string& spec);
+
+// Compare the settings in a device encryption status page to expected,
+// ignoring media_loaded
+bool des_matches(const scsi::page_des& page, const drive_expectation& expected);
+
+// Check that device is in the expected state, using as few commands as
+// possible: one DES, plus a TEST UNIT READY only if media presence matters.
+// When gentle, a drive busy with I/O is taken to have media loaded instead.
+// Errors are written to err.
+check_result check_device(const std::string& device,
+                          const drive_expectation& expected,
+                          std::chrono::milliseconds lock_timeout,
+                          std::ostream& err, bool gentle = false);
+
+} // namespace stenc
+
+#endif
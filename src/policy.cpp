@@ -0,0 +1,179 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include "policy.h"
+
+namespace stenc {
+
+policy::policy(std::vector<policy_rule> rules) : rules {std::move(rules)}
+{
+  // symbols are numbered densely over the bytes used in patterns, which
+  // keeps the transition table small for barcode alphabets
+  for (const auto& rule: this->rules) {
+    for (unsigned char c: rule.pattern) {
+      if (c != '*' && symbols[c] == 0u) {
+        if (alphabet == 255u) {
+          throw std::invalid_argument {"Too many distinct characters"};
+        }
+        symbols[c] = static_cast<std::uint8_t>(++alphabet);
+      }
+    }
+  }
+
+  // one root per policy_key, numbered by its value
+  while (prefix_rules.size() <= static_cast<std::size_t>(policy_key::drive)) {
+    add_node();
+  }
+  for (std::size_t i = 0; i < this->rules.size(); i++) {
+    const auto& rule {this->rules[i]};
+    auto error {[&rule](const std::string& message) {
+      return std::invalid_argument {"Line " + std::to_string(rule.line) +
+                                    ": " + message + ' ' + rule.pattern};
+    }};
+    std::string_view pattern {rule.pattern};
+    const auto star {pattern.find('*')};
+    if (star != pattern.npos && star != pattern.size() - 1) {
+      throw error("'*' allowed only at the end of pattern");
+    }
+    const bool is_prefix {star != pattern.npos};
+    if (is_prefix) {
+      pattern.remove_suffix(1);
+    } else if (pattern.empty()) {
+      throw error("Empty pattern");
+    }
+
+    std::int32_t node {static_cast<std::int32_t>(rule.key)};
+    for (unsigned char c: pattern) {
+      auto slot {static_cast<std::size_t>(node) * alphabet + symbols[c] - 1};
+      if (transitions[slot] == 0) {
+        auto next {add_node()};
+        transitions[slot] = next;
+      }
+      node = transitions[slot];
+    }
+
+    auto& rule_index {is_prefix ? prefix_rules[node] : exact_rules[node]};
+    if (rule_index != none) {
+      throw error("Duplicate pattern");
+    }
+    rule_index = static_cast<std::int32_t>(i);
+  }
+}
+
+std::int32_t policy::add_node()
+{
+  transitions.resize(transitions.size() + alphabet);
+  prefix_rules.push_back(none);
+  exact_rules.push_back(none);
+  return static_cast<std::int32_t>(prefix_rules.size() - 1);
+}
+
+const policy_rule *policy::match(policy_key key,
+                                 std::string_view value) const noexcept
+{
+  std::int32_t node {static_cast<std::int32_t>(key)};
+  auto best {prefix_rules[node]};
+
+  for (unsigned char c: value) {
+    if (symbols[c] == 0u) {
+      node = none;
+      break;
+    }
+    node = transitions[static_cast<std::size_t>(node) * alphabet +
+                       symbols[c] - 1];
+    if (node == 0) {
+      node = none;
+      break;
+    }
+    if (prefix_rules[node] != none) {
+      best = prefix_rules[node];
+    }
+  }
+  if (node != none && exact_rules[node] != none) {
+    best = exact_rules[node];
+  }
+  return best == none ? nullptr : &rules[best];
+}
+
+policy read_policy(std::istream& in)
+{
+  std::vector<policy_rule> rules;
+  std::string line;
+
+  for (std::size_t line_number = 1; std::getline(in, line); line_number++) {
+    std::istringstream fields {line.substr(0, line.find('#'))};
+    std::string pattern, key_file, settings;
+    if (!(fields >> pattern)) {
+      continue;
+    }
+
+    auto error {[&](const std::string& message) {
+      return std::runtime_error {"Line " + std::to_string(line_number) +
+                                 ": " + message};
+    }};
+    auto key {policy_key::barcode};
+    if (pattern.rfind("ukad:", 0) == 0) {
+      key = policy_key::ukad;
+      pattern.erase(0, 5);
+    } else if (pattern.rfind("drive:", 0) == 0) {
+      key = policy_key::drive;
+      pattern.erase(0, 6);
+    }
+
+    // drive rules have no key file
+    if (key != policy_key::drive && !(fields >> key_file)) {
+      throw error("Missing key file");
+    }
+    fields >> settings;
+    std::string rest;
+    if (fields >> rest) {
+      throw error("Unexpected " + rest);
+    }
+
+    auto parsed {settings.empty()
+                     ? std::optional<drive_expectation> {drive_expectation {}}
+                     : parse_expectation(settings)};
+    if (!parsed || parsed->key_name || parsed->media_loaded) {
+      throw error("Invalid settings " + settings);
+    }
+    if (key == policy_key::drive &&
+        (!parsed->scope || parsed->enc_mode || parsed->dec_mode ||
+         parsed->algorithm_index)) {
+      throw error("Drive rules set only the scope");
+    }
+    if (key_file == "none") {
+      key_file.clear();
+    }
+    rules.push_back({key, pattern, key_file, *parsed, line_number});
+  }
+
+  try {
+    return policy {std::move(rules)};
+  } catch (const std::invalid_argument& e) {
+    throw std::runtime_error {e.what()};
+  }
+}
+
+policy load_policy(const std::string& path)
+{
+  std::ifstream in {path};
+  if (!in) {
+    throw std::system_error {errno, std::generic_category(), path};
+  }
+  try {
+    return read_policy(in);
+  } catch (const std::runtime_error& e) {
+    throw std::runtime_error {path + ": " + e.what()};
+  }
+}
+
+} // namespace stenc
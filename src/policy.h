@@ -0,0 +1,92 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+Key policies: rules mapping cartridge barcodes or key descriptors, exactly
+or by prefix, to the key file and encryption settings to use for them, and
+drives to the key scope to use on them. Rules are compiled into a trie when
+loaded, so a barcode is resolved in time linear in its length however many
+rules there are.
+*/
+
+#ifndef _POLICY_H
+#define _POLICY_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "operations.h"
+
+namespace stenc {
+
+// What the pattern of a rule is matched against
+enum class policy_key : std::uint8_t {
+  barcode,
+  ukad, // key descriptor of the data on a tape, e.g. to restore it
+  drive, // device name; rules for drives only set the scope
+};
+
+struct policy_rule {
+  policy_key key;
+  // a value, or a value prefix followed by '*'
+  std::string pattern;
+  // empty for drive rules and rules that turn encryption off
+  std::string key_file;
+  // enc, dec, alg and scope; unset fields are left to the command line
+  drive_expectation settings;
+  // line of the policy file the rule was read from
+  std::size_t line;
+};
+
+class policy {
+public:
+  // Compile rules; throws std::invalid_argument on malformed or duplicate
+  // patterns
+  explicit policy(std::vector<policy_rule> rules);
+
+  // The rule of type key for value: a rule for the exact value, or else the
+  // rule with the longest matching prefix. nullptr if no rule matches.
+  const policy_rule *match(policy_key key,
+                           std::string_view value) const noexcept;
+  const policy_rule *match(std::string_view barcode) const noexcept
+  {
+    return match(policy_key::barcode, barcode);
+  }
+
+  std::size_t size() const noexcept { return rules.size(); }
+
+private:
+  static constexpr std::int32_t none {-1};
+
+  std::int32_t add_node();
+
+  std::vector<policy_rule> rules;
+  // byte value to symbol, 0 for bytes that appear in no pattern
+  std::array<std::uint8_t, 256> symbols {};
+  std::size_t alphabet {};
+  // next node by node and symbol, 0 for none since roots are no targets
+  std::vector<std::int32_t> transitions;
+  // index of the prefix and exact rules ending at each node
+  std::vector<std::int32_t> prefix_rules;
+  std::vector<std::int32_t> exact_rules;
+};
+
+// Read a policy: one rule per line of PATTERN KEY-FILE [SETTINGS], where
+// KEY-FILE is "none" for rules turning encryption off, and SETTINGS is a
+// comma-separated list of enc, dec, alg and scope as in parse_expectation.
+// PATTERN matches a barcode, or a key descriptor when written ukad:PATTERN.
+// Rules for drives are written drive:PATTERN SETTINGS, with SETTINGS
+// holding only scope. '#' starts a comment that runs to the end of the
+// line. Throws std::runtime_error naming the offending line.
+policy read_policy(std::istream& in);
+policy load_policy(const std::string& path);
+
+} // namespace stenc
+
+#endif
@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <mutex>
+#include <unordered_map>
+
+#include "quirks.h"
+
+namespace stenc {
+
+// inquiry strings are space padded to their fixed width
+static std::string_view trimmed(const char *s, std::size_t length)
+{
+  while (length > 0 && (s[length - 1] == ' ' || s[length - 1] == '\0')) {
+    length--;
+  }
+  return {s, length};
+}
+
+const drive_quirks& find_quirks(const scsi::inquiry_data& inq)
+{
+  return find_quirks(trimmed(inq.vendor, sizeof(inq.vendor)),
+                     trimmed(inq.product_id, sizeof(inq.product_id)),
+                     trimmed(inq.product_rev, sizeof(inq.product_rev)));
+}
+
+const drive_quirks& device_quirks(const std::string& device)
+{
+  if constexpr (!has_model_quirks) {
+    return quirk_table[0].quirks;
+  }
+
+  static std::mutex mutex;
+  static std::unordered_map<std::string, const drive_quirks *> known;
+
+  {
+    std::lock_guard<std::mutex> guard {mutex};
+    if (auto it {known.find(device)}; it != known.end()) {
+      return *it->second;
+    }
+  }
+  // entries are never removed, so a concurrent lookup of the same device
+  // at worst issues a second INQUIRY
+  auto& quirks {find_quirks(scsi::get_inquiry(device))};
+  std::lock_guard<std::mutex> guard {mutex};
+  known.emplace(device, &quirks);
+  return quirks;
+}
+
+} // namespace stenc
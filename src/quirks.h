@@ -0,0 +1,91 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+Known deviations of drive models from SSC, looked up by the vendor, product
+and revision a drive reports in its standard INQUIRY data, so that commands
+known to fail on a model are not issued at all
+*/
+
+#ifndef _QUIRKS_H
+#define _QUIRKS_H
+
+#include <chrono>
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#include "scsiencrypt.h"
+
+namespace stenc {
+
+struct drive_quirks {
+  // NEXT BLOCK ENCRYPTION STATUS may fail with BLANK CHECK, e.g. on a tape
+  // that has not been written yet (#71)
+  bool nbes_blank_check;
+  // drive cannot report NEXT BLOCK ENCRYPTION STATUS
+  bool no_nbes;
+  // drive rejects key descriptors shorter than the maximum length even
+  // though it does not report fixed length key descriptors
+  bool pad_ukad;
+  // drive rejects raw decryption mode control
+  bool no_rdmc;
+  // time the drive takes to set data encryption, if longer than usual
+  std::chrono::milliseconds sde_timeout;
+};
+
+// Patterns match exactly, or by prefix if they end in '*'
+struct quirk_entry {
+  std::string_view vendor;
+  std::string_view product;
+  std::string_view revision;
+  drive_quirks quirks;
+};
+
+constexpr bool matches_pattern(std::string_view pattern,
+                               std::string_view value)
+{
+  if (!pattern.empty() && pattern.back() == '*') {
+    pattern.remove_suffix(1);
+    return value.substr(0, pattern.size()) == pattern;
+  }
+  return value == pattern;
+}
+
+// Specific models go before the patterns that would also match them; the
+// last entry matches every drive.
+inline constexpr quirk_entry quirk_table[] {
+    {"*", "*", "*", {true, false, false, false, {}}},
+};
+
+// Whether the table tells drive models apart at all, i.e. whether finding
+// the quirks of a drive is worth an INQUIRY
+inline constexpr bool has_model_quirks {std::size(quirk_table) > 1u};
+
+// Return the quirks of the first entry matching a drive model
+constexpr const drive_quirks& find_quirks(std::string_view vendor,
+                                          std::string_view product,
+                                          std::string_view revision)
+{
+  for (const auto& entry: quirk_table) {
+    if (matches_pattern(entry.vendor, vendor) &&
+        matches_pattern(entry.product, product) &&
+        matches_pattern(entry.revision, revision)) {
+      return entry.quirks;
+    }
+  }
+  return quirk_table[std::size(quirk_table) - 1].quirks;
+}
+
+const drive_quirks& find_quirks(const scsi::inquiry_data& inq);
+
+// Quirks of device, from an INQUIRY issued on the first call for device
+// only, and not at all while the table has no model-specific entries. Safe
+// to call from several threads.
+const drive_quirks& device_quirks(const std::string& device);
+
+} // namespace stenc
+
+#endif
@@ -0,0 +1,95 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <config.h>
+
+#include <algorithm>
+#include <list>
+#include <sstream>
+#include <thread>
+
+#include "rotation.h"
+
+namespace stenc {
+
+std::vector<change_outcome>
+spread_changes(std::size_t count, const spread_options& options,
+               const std::function<bool(std::size_t)>& is_busy,
+               const std::function<change_outcome(std::size_t)>& change,
+               const std::function<void(const std::string&)>& progress,
+               const spread_clock& clock)
+{
+  std::vector<change_outcome> outcomes(count, change_outcome::deferred);
+  if (count == 0) {
+    return outcomes;
+  }
+  auto sleep_until {clock.sleep_until};
+  if (!sleep_until) {
+    sleep_until = [](std::chrono::steady_clock::time_point t) {
+      std::this_thread::sleep_until(t);
+    };
+  }
+  const auto start {clock.now()};
+  const auto deadline {start + options.window};
+  const auto interval {options.window / count};
+
+  std::list<std::size_t> pending;
+  for (std::size_t i = 0; i < count; i++) {
+    pending.push_back(i);
+  }
+  std::size_t changed {}, unchanged {}, failed {};
+  auto next_slot {start};
+
+  while (!pending.empty()) {
+    auto it {std::find_if(pending.begin(), pending.end(),
+                          [&](std::size_t i) { return !is_busy(i); })};
+    if (it == pending.end()) {
+      const auto now {clock.now()};
+      if (now >= deadline) {
+        break;
+      }
+      sleep_until(std::min(now + options.retry_interval, deadline));
+      continue;
+    }
+
+    const auto i {*it};
+    pending.erase(it);
+    outcomes[i] = change(i);
+    switch (outcomes[i]) {
+    case change_outcome::changed:
+      changed++;
+      break;
+    case change_outcome::unchanged:
+      unchanged++;
+      break;
+    default:
+      failed++;
+      break;
+    }
+
+    std::ostringstream oss;
+    oss << "Key change progress: " << changed << " changed, " << unchanged
+        << " already set, " << failed << " failed, " << pending.size()
+        << " remaining of " << count << " drives";
+    progress(oss.str());
+
+    // only drives that were sent new settings use up a slot
+    if (outcomes[i] != change_outcome::unchanged && !pending.empty()) {
+      next_slot += interval;
+      if (next_slot > clock.now()) {
+        sleep_until(next_slot);
+      }
+    }
+  }
+
+  if (!pending.empty()) {
+    std::ostringstream oss;
+    oss << "Key change deferred on " << pending.size()
+        << " drives that stayed busy";
+    progress(oss.str());
+  }
+  return outcomes;
+}
+
+} // namespace stenc
@@ -0,0 +1,52 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+Key changes on many drives spread across a time window, rather than all at
+once, so that the SCSI load stays low and drives busy with I/O can be left
+until they are idle
+*/
+
+#ifndef _ROTATION_H
+#define _ROTATION_H
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "operations.h"
+
+namespace stenc {
+
+struct spread_options {
+  // time over which to spread the changes
+  std::chrono::milliseconds window;
+  // how often to look for a drive that has become idle
+  std::chrono::milliseconds retry_interval;
+};
+
+// Time source for spread_changes, replaceable for testing
+struct spread_clock {
+  std::function<std::chrono::steady_clock::time_point()> now {
+      std::chrono::steady_clock::now};
+  std::function<void(std::chrono::steady_clock::time_point)> sleep_until;
+};
+
+// Apply change to each of count drives, one at a time and at most one per
+// window / count, idle drives first. Busy drives are deferred and retried
+// until the window has passed, after which they are reported as deferred.
+// Drives that need no change take no time from the window. progress is
+// called with a message after each drive.
+std::vector<change_outcome>
+spread_changes(std::size_t count, const spread_options& options,
+               const std::function<bool(std::size_t)>& is_busy,
+               const std::function<change_outcome(std::size_t)>& change,
+               const std::function<void(const std::string&)>& progress,
+               const spread_clock& clock = {});
+
+} // namespace stenc
+
+#endif
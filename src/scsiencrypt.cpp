@@ -18,14 +18,20 @@ GNU General Public License for more details.
 */
 #include <config.h>
 
+#include <atomic>
 #include <cerrno>
 #include <cstring>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <list>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 
 #include <fcntl.h>
 #include <sys/ioctl.h>
@@ -37,12 +43,14 @@ GNU General Public License for more details.
 #if defined(OS_LINUX)
 #include <scsi/scsi.h>
 #include <scsi/sg.h>
+#include <sys/mtio.h>
 constexpr unsigned int SCSI_TIMEOUT {5000u};
 #elif defined(OS_FREEBSD)
 #include <cam/scsi/scsi_message.h>
 #include <camlib.h>
 constexpr unsigned int SCSI_TIMEOUT {5000u};
 constexpr unsigned int RETRYCOUNT {1u};
+static std::mutex cam_errbuf_mutex;
 #else
 #error "OS type is not set"
 #endif
@@ -53,6 +61,9 @@ constexpr std::uint8_t SSP_SPIN_OPCODE = 0xa2;
 constexpr std::uint8_t SSP_SPOUT_OPCODE = 0xb5;
 constexpr std::uint8_t SSP_SP_CMD_LEN = 12;
 constexpr std::uint8_t SSP_SP_PROTOCOL_TDE = 0x20;
+constexpr std::uint8_t PR_IN_OPCODE = 0x5e;
+constexpr std::uint8_t PR_IN_READ_RESERVATION = 0x01;
+constexpr std::uint8_t SCSI_STATUS_RESERVATION_CONFLICT = 0x18;
 
 #define BSINTTOCHAR(x)                                                         \
   static_cast<std::uint8_t>((x) >> 24), static_cast<std::uint8_t>((x) >> 16),  \
@@ -88,6 +99,124 @@ using unique_fd =
 
 enum class scsi_direction { to_device, from_device };
 
+#if defined(OS_LINUX)
+using device_handle = unique_fd;
+
+static device_handle open_device(const std::string& device)
+{
+  unique_fd fd {open(device.c_str(), O_RDONLY | O_NDELAY)};
+  if (!fd) {
+    auto err {errno}; // before anything else can overwrite it
+    std::ostringstream oss;
+    oss << "Cannot open device " << device;
+    throw std::system_error {err, std::generic_category(), oss.str()};
+  }
+  return fd;
+}
+#elif defined(OS_FREEBSD)
+using device_handle =
+    std::unique_ptr<struct cam_device, decltype(&cam_close_device)>;
+
+static device_handle open_device(const std::string& device)
+{
+  // cam_open_device reports errors in the process-wide cam_errbuf
+  std::lock_guard<std::mutex> cam_errbuf_guard {cam_errbuf_mutex};
+  device_handle dev {cam_open_device(device.c_str(), O_RDWR),
+                     &cam_close_device};
+  if (dev == nullptr) {
+    std::ostringstream oss;
+    oss << "Cannot open device " << device << ": " << cam_errbuf;
+    throw std::runtime_error {oss.str()};
+  }
+  return dev;
+}
+#endif
+
+// see scsi::set_driver_status
+static std::atomic<bool> driver_status {false};
+
+// Open device handles kept between commands, see scsi::set_session_capacity.
+// Handles are shared, so evicting one that is in use by another thread only
+// closes it once that thread is done with it.
+class session_pool {
+public:
+  using session = std::shared_ptr<device_handle>;
+
+  // Return an open handle to device and whether it was taken from the pool
+  std::pair<session, bool> acquire(const std::string& device)
+  {
+    {
+      std::lock_guard<std::mutex> guard {mutex};
+      auto it {index.find(device)};
+      if (it != index.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        stats.hits++;
+        return {it->second->second, true};
+      }
+      stats.misses++;
+    }
+
+    // open outside the lock, as opening a tape device may take a while
+    auto handle {std::make_shared<device_handle>(open_device(device))};
+    std::lock_guard<std::mutex> guard {mutex};
+    if (capacity > 0u && index.find(device) == index.end()) {
+      lru.emplace_front(device, handle);
+      index.emplace(device, lru.begin());
+      shrink(capacity);
+    }
+    return {handle, false};
+  }
+
+  void close(const std::string& device)
+  {
+    std::lock_guard<std::mutex> guard {mutex};
+    auto it {index.find(device)};
+    if (it != index.end()) {
+      lru.erase(it->second);
+      index.erase(it);
+    }
+  }
+
+  void set_capacity(std::size_t n)
+  {
+    std::lock_guard<std::mutex> guard {mutex};
+    capacity = n;
+    shrink(capacity);
+  }
+
+  scsi::session_stats get_stats()
+  {
+    std::lock_guard<std::mutex> guard {mutex};
+    auto result {stats};
+    result.open = lru.size();
+    return result;
+  }
+
+private:
+  void shrink(std::size_t n)
+  {
+    while (lru.size() > n) {
+      index.erase(lru.back().first);
+      lru.pop_back();
+      stats.evictions++;
+    }
+  }
+
+  std::mutex mutex;
+  std::size_t capacity {};
+  // most recently used first
+  std::list<std::pair<std::string, session>> lru;
+  std::unordered_map<std::string, decltype(lru)::iterator> index;
+  scsi::session_stats stats {};
+};
+
+// The one piece of state the SCSI layer keeps between calls. Commands
+// address devices by path, so a pool passed in by the caller would have to
+// be threaded through every command and operation. A pool left at its
+// default capacity of 0 keeps no handles, so results never depend on it;
+// callers that enable it only change how long devices stay open.
+static session_pool sessions;
+
 struct hex {
   std::uint8_t value;
 };
@@ -104,34 +233,40 @@ inline std::ostream& operator<<(std::ostream& os, hex h)
   return os;
 }
 
+// stream receiving SCSI debug dumps, per thread, see scsi::set_debug_output
+static thread_local std::ostream *debug_output {&std::cerr};
+
+#if defined(DEBUGSCSI)
+static void debug_dump(const char *label, const std::uint8_t *begin,
+                       const std::uint8_t *end)
+{
+  if (debug_output == nullptr) {
+    return;
+  }
+  auto& os {*debug_output};
+  os << label;
+  while (begin < end) {
+    os << hex {*begin++} << ' ';
+  }
+  os << '\n';
+}
+#endif
+
 static void scsi_execute(const std::string& device, const std::uint8_t *cmd_p,
                          std::size_t cmd_len, std::uint8_t *dxfer_p,
-                         std::size_t dxfer_len, scsi_direction direction)
+                         std::size_t dxfer_len, scsi_direction direction,
+                         unsigned int timeout = SCSI_TIMEOUT)
 {
 #if defined(DEBUGSCSI)
-  std::cerr << "SCSI Command: ";
-  for (std::size_t i = 0; i < cmd_len; i++) {
-    std::cerr << hex {cmd_p[i]} << ' ';
-  }
-  std::cerr << '\n';
-
+  debug_dump("SCSI Command: ", cmd_p, cmd_p + cmd_len);
   if (direction == scsi_direction::to_device && dxfer_len > 0u) {
-    std::cerr << "SCSI Data: ";
-    for (std::size_t i = 0; i < dxfer_len; i++) {
-      std::cerr << hex {dxfer_p[i]} << ' ';
-    }
-    std::cerr << '\n';
+    debug_dump("SCSI Data: ", dxfer_p, dxfer_p + dxfer_len);
   }
 #endif
 
-#if defined(OS_LINUX)
-  unique_fd fd {open(device.c_str(), O_RDONLY | O_NDELAY)};
-  if (!fd) {
-    std::ostringstream oss;
-    oss << "Cannot open device " << device;
-    throw std::system_error {errno, std::generic_category(), oss.str()};
-  }
+  [[maybe_unused]] auto [session, cached] {sessions.acquire(device)};
 
+#if defined(OS_LINUX)
   sg_io_hdr cmdio {};
   auto sense_buf {std::make_unique<scsi::sense_buffer>()};
 
@@ -144,25 +279,35 @@ static void scsi_execute(const std::string& device, const std::uint8_t *cmd_p,
   cmdio.cmdp = const_cast<unsigned char *>(cmd_p);
   cmdio.sbp = sense_buf->data();
   cmdio.mx_sb_len = sizeof(decltype(sense_buf)::element_type);
-  cmdio.timeout = SCSI_TIMEOUT;
+  cmdio.timeout = timeout;
   cmdio.interface_id = 'S';
 
-  if (ioctl(fd.get(), SG_IO, &cmdio)) {
-    throw std::system_error {errno, std::generic_category()};
+  while (ioctl(session->get(), SG_IO, &cmdio)) {
+    auto err {errno};
+    if (!cached || (err != ENODEV && err != ENXIO && err != EBADF)) {
+      throw std::system_error {err, std::generic_category()};
+    }
+    // the device went away since the handle was pooled, e.g. after a
+    // rescan of the bus; reopen it once
+    sessions.close(device);
+    std::tie(session, cached) = sessions.acquire(device);
+  }
+  if (cmdio.host_status) {
+    std::ostringstream oss;
+    oss << "Transport error on " << device << " (host status 0x"
+        << hex {static_cast<std::uint8_t>(cmdio.host_status)} << ')';
+    throw scsi::transport_error {oss.str()};
+  }
+  if (cmdio.status == SCSI_STATUS_RESERVATION_CONFLICT) {
+    throw scsi::reservation_conflict {};
   }
   if (cmdio.status) {
     throw scsi::scsi_error {std::move(sense_buf)};
   }
 #elif defined(OS_FREEBSD)
-  auto dev = std::unique_ptr<struct cam_device, decltype(&cam_close_device)> {
-      cam_open_device(device.c_str(), O_RDWR), &cam_close_device};
-  if (dev == nullptr) {
-    std::ostringstream oss;
-    oss << "Cannot open device " << device << ": " << cam_errbuf;
-    throw std::runtime_error {oss.str()};
-  }
+  auto dev {session->get()};
   auto ccb = std::unique_ptr<union ccb, decltype(&cam_freeccb)> {
-      cam_getccb(dev.get()), &cam_freeccb};
+      cam_getccb(dev), &cam_freeccb};
   if (ccb == nullptr) {
     throw std::bad_alloc {};
   }
@@ -172,12 +317,21 @@ static void scsi_execute(const std::string& device, const std::uint8_t *cmd_p,
       &ccb->csio, RETRYCOUNT, nullptr,
       CAM_PASS_ERR_RECOVER | CAM_CDB_POINTER |
           (direction == scsi_direction::to_device ? CAM_DIR_OUT : CAM_DIR_IN),
-      MSG_SIMPLE_Q_TAG, dxfer_p, dxfer_len, SSD_FULL_SIZE, cmd_len,
-      SCSI_TIMEOUT);
+      MSG_SIMPLE_Q_TAG, dxfer_p, dxfer_len, SSD_FULL_SIZE, cmd_len, timeout);
   ccb->csio.cdb_io.cdb_ptr = const_cast<u_int8_t *>(cmd_p);
-  if (cam_send_ccb(dev.get(), ccb.get())) {
+  if (cam_send_ccb(dev, ccb.get())) {
     throw std::system_error {errno, std::generic_category()};
   }
+  auto cam_status {ccb->ccb_h.status & CAM_STATUS_MASK};
+  if (cam_status != CAM_REQ_CMP && cam_status != CAM_SCSI_STATUS_ERROR) {
+    std::ostringstream oss;
+    oss << "Transport error on " << device << " (CAM status 0x"
+        << hex {static_cast<std::uint8_t>(cam_status)} << ')';
+    throw scsi::transport_error {oss.str()};
+  }
+  if (ccb->csio.scsi_status == SCSI_STATUS_RESERVATION_CONFLICT) {
+    throw scsi::reservation_conflict {};
+  }
   if (ccb->csio.scsi_status) {
     auto sense_buf {std::make_unique<scsi::sense_buffer>()};
     std::memcpy(sense_buf->data(), &ccb->csio.sense_data,
@@ -191,10 +345,35 @@ static void scsi_execute(const std::string& device, const std::uint8_t *cmd_p,
 
 namespace scsi {
 
+void set_debug_output(std::ostream *os) noexcept { debug_output = os; }
+
+void set_session_capacity(std::size_t capacity)
+{
+  sessions.set_capacity(capacity);
+}
+
+void close_session(const std::string& device) { sessions.close(device); }
+
+void set_driver_status(bool enable) noexcept { driver_status = enable; }
+
+session_stats get_session_stats() { return sessions.get_stats(); }
+
 bool is_device_ready(const std::string& device)
 {
   const std::uint8_t test_unit_ready_cmd[6] {};
 
+#if defined(OS_LINUX)
+  if (driver_status) {
+    auto session {sessions.acquire(device).first};
+    mtget status {};
+    // the st driver answers from the state it keeps since the device was
+    // opened; other drivers reject the request
+    if (ioctl(session->get(), MTIOCGET, &status) == 0) {
+      return GMT_ONLINE(status.mt_gstat) && !GMT_DR_OPEN(status.mt_gstat);
+    }
+  }
+#endif
+
   try {
     scsi_execute(device, test_unit_ready_cmd, sizeof(test_unit_ready_cmd),
                  nullptr, 0u, scsi_direction::from_device);
@@ -222,15 +401,10 @@ void get_des(const std::string& device, std::uint8_t *buffer,
                length, scsi_direction::from_device);
 
 #if defined(DEBUGSCSI)
-  std::cerr << "SCSI Response: ";
   auto& page {reinterpret_cast<const page_des&>(*buffer)};
-  std::uint8_t *it {buffer};
-  const std::uint8_t *end {
-      buffer + std::min(length, sizeof(page_header) + ntohs(page.length))};
-  while (it < end) {
-    std::cerr << hex {*it++} << ' ';
-  }
-  std::cerr << '\n';
+  debug_dump(
+      "SCSI Response: ", buffer,
+      buffer + std::min(length, sizeof(page_header) + ntohs(page.length)));
 #endif
 }
 
@@ -252,15 +426,10 @@ void get_nbes(const std::string& device, std::uint8_t *buffer,
                length, scsi_direction::from_device);
 
 #if defined(DEBUGSCSI)
-  std::cerr << "SCSI Response: ";
   auto& page {reinterpret_cast<const page_nbes&>(*buffer)};
-  std::uint8_t *it {buffer};
-  const std::uint8_t *end {
-      buffer + std::min(length, sizeof(page_header) + ntohs(page.length))};
-  while (it < end) {
-    std::cerr << hex {*it++} << ' ';
-  }
-  std::cerr << '\n';
+  debug_dump(
+      "SCSI Response: ", buffer,
+      buffer + std::min(length, sizeof(page_header) + ntohs(page.length)));
 #endif
 }
 
@@ -282,15 +451,10 @@ void get_dec(const std::string& device, std::uint8_t *buffer,
                length, scsi_direction::from_device);
 
 #if defined(DEBUGSCSI)
-  std::cerr << "SCSI Response: ";
   auto& page {reinterpret_cast<const page_dec&>(*buffer)};
-  std::uint8_t *it {buffer};
-  const std::uint8_t *end {
-      buffer + std::min(length, sizeof(page_header) + ntohs(page.length))};
-  while (it < end) {
-    std::cerr << hex {*it++} << ' ';
-  }
-  std::cerr << '\n';
+  debug_dump(
+      "SCSI Response: ", buffer,
+      buffer + std::min(length, sizeof(page_header) + ntohs(page.length)));
 #endif
 }
 
@@ -305,61 +469,171 @@ inquiry_data get_inquiry(const std::string& device)
                scsi_direction::from_device);
 
 #if defined(DEBUGSCSI)
-  std::cerr << "SCSI Response: ";
-  std::uint8_t *it {reinterpret_cast<std::uint8_t *>(&inq)};
-  const std::uint8_t *end {
-      reinterpret_cast<std::uint8_t *>(&inq) +
-      std::min(sizeof(inquiry_data),
-               inquiry_data::header_size + inq.additional_length)};
-  while (it < end) {
-    std::cerr << hex {*it++} << ' ';
-  }
-  std::cerr << '\n';
+  auto begin {reinterpret_cast<const std::uint8_t *>(&inq)};
+  debug_dump("SCSI Response: ", begin,
+             begin + std::min(sizeof(inquiry_data),
+                              inquiry_data::header_size +
+                                  inq.additional_length));
 #endif
 
   return inq;
 }
 
+void get_device_identification(const std::string& device,
+                               std::uint8_t *buffer, std::size_t length)
+{
+  const std::uint8_t scsi_vpd_command[] {
+      0x12, 0x01, 0x83, static_cast<std::uint8_t>(length >> 8),
+      static_cast<std::uint8_t>(length), 0,
+  };
+  scsi_execute(device, scsi_vpd_command, sizeof(scsi_vpd_command), buffer,
+               length, scsi_direction::from_device);
+
+#if defined(DEBUGSCSI)
+  debug_dump("SCSI Response: ", buffer,
+             buffer + std::min<std::size_t>(
+                          length, 4u + (buffer[2] << 8 | buffer[3])));
+#endif
+}
+
+std::string logical_unit_designator(const std::uint8_t *page,
+                                    std::size_t length)
+{
+  // designator types in order of preference: NAA, EUI-64, SCSI name
+  // string, T10 vendor ID
+  constexpr std::uint8_t preferred_types[] {3u, 2u, 8u, 1u};
+  constexpr const char *prefixes[] {"naa.", "eui.", "", "t10."};
+  const std::uint8_t *best {};
+  std::size_t best_rank {sizeof(preferred_types)};
+
+  if (length < 4u) {
+    return {};
+  }
+  const auto end {page + std::min<std::size_t>(
+                             length, 4u + (page[2] << 8 | page[3]))};
+  for (auto it {page + 4}; it + 4 <= end && it + 4 + it[3] <= end;
+       it += 4 + it[3]) {
+    if ((it[1] & 0x30u) != 0u) {
+      continue; // designates a port or target, not the logical unit
+    }
+    for (std::size_t rank = 0; rank < best_rank; rank++) {
+      if ((it[1] & 0x0fu) == preferred_types[rank]) {
+        best = it;
+        best_rank = rank;
+      }
+    }
+  }
+  if (best == nullptr) {
+    return {};
+  }
+
+  std::ostringstream oss;
+  oss << prefixes[best_rank];
+  auto designator {best + 4};
+  auto code_set {best[0] & 0x0fu};
+  if (code_set == 2u || code_set == 3u) { // ASCII or UTF-8
+    std::string s {reinterpret_cast<const char *>(designator), best[3]};
+    s.erase(s.find_last_not_of(std::string {" \0", 2}) + 1);
+    oss << s;
+  } else {
+    for (std::size_t i = 0; i < best[3]; i++) {
+      oss << hex {designator[i]};
+    }
+  }
+  return oss.str();
+}
+
+reservation_data get_reservation(const std::string& device)
+{
+  const std::uint8_t pr_in_command[] {
+      PR_IN_OPCODE, PR_IN_READ_RESERVATION, 0, 0, 0, 0, 0, 0,
+      sizeof(reservation_data), 0,
+  };
+  reservation_data rd {};
+  scsi_execute(device, pr_in_command, sizeof(pr_in_command),
+               reinterpret_cast<std::uint8_t *>(&rd), sizeof(rd),
+               scsi_direction::from_device);
+
+#if defined(DEBUGSCSI)
+  auto begin {reinterpret_cast<const std::uint8_t *>(&rd)};
+  debug_dump("SCSI Response: ", begin,
+             begin + std::min(sizeof(reservation_data),
+                              reservation_data::header_size +
+                                  ntohl(rd.additional_length)));
+#endif
+
+  return rd;
+}
+
 std::unique_ptr<const std::uint8_t[]>
 make_sde(encrypt_mode enc_mode, decrypt_mode dec_mode,
          std::uint8_t algorithm_index, const std::vector<std::uint8_t>& key,
-         const std::string& key_name, kadf kad_format, sde_rdmc rdmc, bool ckod)
+         const std::string& key_name, kadf kad_format, sde_rdmc rdmc, bool ckod,
+         bool ckorp, bool ckorl, nexus_scope scope)
 {
   std::size_t length {sizeof(page_sde) + key.size()};
   if (!key_name.empty()) {
     length += sizeof(kad) + key_name.size();
   }
   auto buffer {std::make_unique<std::uint8_t[]>(length)};
-  auto& page {reinterpret_cast<page_sde&>(*buffer.get())};
+  make_sde(buffer.get(), length, enc_mode, dec_mode, algorithm_index,
+           key.data(), key.size(), key_name, kad_format, rdmc, ckod, ckorp,
+           ckorl, scope);
+  return buffer;
+}
+
+std::size_t make_sde(std::uint8_t *buffer, std::size_t buffer_length,
+                     encrypt_mode enc_mode, decrypt_mode dec_mode,
+                     std::uint8_t algorithm_index, const std::uint8_t *key,
+                     std::size_t key_length, const std::string& key_name,
+                     kadf kad_format, sde_rdmc rdmc, bool ckod, bool ckorp,
+                     bool ckorl, nexus_scope scope)
+{
+  std::size_t length {sizeof(page_sde) + key_length};
+  if (!key_name.empty()) {
+    length += sizeof(kad) + key_name.size();
+  }
+  if (length > buffer_length) {
+    throw std::length_error {"Set data encryption page exceeds buffer"};
+  }
+  std::memset(buffer, 0, length);
+  auto& page {reinterpret_cast<page_sde&>(*buffer)};
 
   page.page_code = htons(0x10);
   page.length = htons(length - sizeof(page_header));
-  page.control = std::byte {2u}
-                 << page_sde::control_scope_pos; // all IT nexus = 10b
+  page.control = std::byte {static_cast<std::uint8_t>(scope)}
+                 << page_sde::control_scope_pos;
   // no external encryption mode check for widest compatibility of reads
   page.flags |= std::byte {1u} << page_sde::flags_ceem_pos;
   page.flags |= std::byte {static_cast<std::underlying_type_t<sde_rdmc>>(rdmc)};
   if (ckod) {
     page.flags |= page_sde::flags_ckod_mask;
   }
+  if (ckorp) {
+    page.flags |= page_sde::flags_ckorp_mask;
+  }
+  if (ckorl) {
+    page.flags |= page_sde::flags_ckorl_mask;
+  }
   page.encryption_mode = enc_mode;
   page.decryption_mode = dec_mode;
   page.algorithm_index = algorithm_index;
   page.kad_format = kad_format;
-  page.key_length = htons(key.size());
-  std::memcpy(page.key, key.data(), key.size());
+  page.key_length = htons(key_length);
+  std::memcpy(page.key, key, key_length);
 
   if (!key_name.empty()) {
-    auto& ukad {reinterpret_cast<kad&>(
-        *(buffer.get() + sizeof(page_sde) + key.size()))};
+    auto& ukad {
+        reinterpret_cast<kad&>(*(buffer + sizeof(page_sde) + key_length))};
     ukad.length = htons(key_name.size());
     std::memcpy(ukad.descriptor, key_name.data(), key_name.size());
   }
 
-  return buffer;
+  return length;
 }
 
-void write_sde(const std::string& device, const std::uint8_t *sde_buffer)
+void write_sde(const std::string& device, const std::uint8_t *sde_buffer,
+               std::chrono::milliseconds timeout)
 {
   auto& page {reinterpret_cast<const page_sde&>(*sde_buffer)};
   std::size_t length {sizeof(page_header) + ntohs(page.length)};
@@ -377,14 +651,117 @@ void write_sde(const std::string& device, const std::uint8_t *sde_buffer)
 
   scsi_execute(device, spout_sde_command, sizeof(spout_sde_command),
                const_cast<std::uint8_t *>(sde_buffer), length,
-               scsi_direction::to_device);
+               scsi_direction::to_device,
+               timeout.count() > 0 ? static_cast<unsigned int>(timeout.count())
+                                   : SCSI_TIMEOUT);
+}
+
+sense_view::sense_view(const std::uint8_t *data, std::size_t length) noexcept
+    : p {data}, length {length}
+{
+  // trust the additional sense length only as far as the buffer goes
+  if (length >= sense_data::header_size) {
+    this->length = std::min(length, sense_data::header_size + p[7]);
+  }
+}
+
+bool sense_view::valid() const noexcept
+{
+  auto code {byte(0) & 0x7fu};
+  return code >= 0x70u && code <= 0x73u;
+}
+
+bool sense_view::descriptor_format() const noexcept
+{
+  auto code {byte(0) & 0x7fu};
+  return code == 0x72u || code == 0x73u;
+}
+
+bool sense_view::deferred() const noexcept
+{
+  auto code {byte(0) & 0x7fu};
+  return code == 0x71u || code == 0x73u;
 }
 
-void print_sense_data(std::ostream& os, const sense_data& sd)
+std::byte sense_view::sense_key() const noexcept
+{
+  return std::byte {static_cast<std::uint8_t>(
+             byte(descriptor_format() ? 1u : 2u))} &
+         sense_data::flags_sense_key_mask;
+}
+
+std::uint8_t sense_view::asc() const noexcept
+{
+  return byte(descriptor_format() ? 2u : 12u);
+}
+
+std::uint8_t sense_view::ascq() const noexcept
+{
+  return byte(descriptor_format() ? 3u : 13u);
+}
+
+std::size_t sense_view::find_descriptor(std::uint8_t type) const noexcept
+{
+  // each descriptor is a type, an additional length and its contents
+  for (auto i {sense_data::header_size}; i + 2u <= length;
+       i += 2u + p[i + 1u]) {
+    if (p[i] == type) {
+      return i;
+    }
+  }
+  return 0u;
+}
+
+std::optional<std::uint64_t> sense_view::information() const noexcept
+{
+  std::size_t offset {3u};
+  std::size_t count {4u};
+  if (descriptor_format()) {
+    offset = find_descriptor(0x00u);
+    if (offset == 0u || (byte(offset + 2u) & 0x80u) == 0u) {
+      return {};
+    }
+    offset += 4u;
+    count = 8u;
+  } else if ((byte(0) & 0x80u) == 0u) {
+    return {};
+  }
+  if (offset + count > length) {
+    return {};
+  }
+  std::uint64_t value {};
+  for (std::size_t i = 0; i < count; i++) {
+    value = value << 8 | p[offset + i];
+  }
+  return value;
+}
+
+std::optional<std::uint16_t> sense_view::progress() const noexcept
+{
+  auto key {sense_key()};
+  if (key != sense_data::no_sense && key != sense_data::not_ready) {
+    return {};
+  }
+  std::size_t offset {15u};
+  if (descriptor_format()) {
+    offset = find_descriptor(0x02u);
+    if (offset == 0u) {
+      return {};
+    }
+    offset += 4u;
+  }
+  // sense key specific valid
+  if (offset + 3u > length || (p[offset] & 0x80u) == 0u) {
+    return {};
+  }
+  return static_cast<std::uint16_t>(p[offset + 1u] << 8 | p[offset + 2u]);
+}
+
+void print_sense_data(std::ostream& os, const sense_view& sense)
 {
   os << std::left << std::setw(25) << "Sense Code: ";
 
-  auto sense_key {sd.flags & sense_data::flags_sense_key_mask};
+  auto sense_key {sense.sense_key()};
 
   switch (sense_key) {
   case sense_data::no_sense:
@@ -419,23 +796,152 @@ void print_sense_data(std::ostream& os, const sense_data& sd)
   os << " (0x" << hex {static_cast<std::uint8_t>(sense_key)} << ")\n";
 
   os << std::left << std::setw(25) << " ASC:"
-     << "0x" << hex {sd.additional_sense_code} << '\n';
+     << "0x" << hex {sense.asc()} << '\n';
 
   os << std::left << std::setw(25) << " ASCQ:"
-     << "0x" << hex {sd.additional_sense_qualifier} << '\n';
+     << "0x" << hex {sense.ascq()} << '\n';
 
-#if defined(DEBUGSCSI)
-  auto sense_data_length {sd.additional_sense_length + sense_data::header_size};
-  auto rawsense {reinterpret_cast<const std::uint8_t *>(&sd)};
+  if (auto progress {sense.progress()}) {
+    os << std::left << std::setw(25) << " Progress:" << std::dec
+       << *progress * 100u / 65536u << "%\n";
+  }
 
+#if defined(DEBUGSCSI)
   os << std::left << std::setw(25) << " Raw sense data:";
-  for (std::size_t i = 0; i < sense_data_length; i++) {
-    os << hex {rawsense[i]} << ' ';
+  for (std::size_t i = 0; i < sense.size(); i++) {
+    os << hex {sense.data()[i]} << ' ';
   }
   os << '\n';
 #endif
 }
 
+void print_reservation(std::ostream& os, const reservation_data& rd)
+{
+  if (ntohl(rd.additional_length) == 0u) {
+    // RESERVE(6)/RESERVE(10) reservations are not reported by PERSISTENT
+    // RESERVE IN
+    os << std::left << std::setw(25) << "Reservation Holder:"
+       << "Unknown, no persistent reservation\n";
+    return;
+  }
+
+  os << std::left << std::setw(25) << "Reservation Key:"
+     << "0x";
+  for (auto b: rd.reservation_key) {
+    os << hex {b};
+  }
+  os << '\n';
+
+  os << std::left << std::setw(25) << "Reservation Type:";
+  auto type {static_cast<unsigned int>(rd.scope_type &
+                                       reservation_data::scope_type_type_mask)};
+  switch (type) {
+  case 1u:
+    os << "Write Exclusive";
+    break;
+  case 3u:
+    os << "Exclusive Access";
+    break;
+  case 5u:
+    os << "Write Exclusive - Registrants Only";
+    break;
+  case 6u:
+    os << "Exclusive Access - Registrants Only";
+    break;
+  case 7u:
+    os << "Write Exclusive - All Registrants";
+    break;
+  case 8u:
+    os << "Exclusive Access - All Registrants";
+    break;
+  default:
+    os << "Unknown";
+  }
+  os << " (0x" << hex {static_cast<std::uint8_t>(type)} << ")\n";
+}
+
+void print_algorithm_name(std::ostream& os, const std::uint32_t code)
+{
+  // Reference: SFSC / INCITS 501-2016
+  if (0x80010400 <= code && code <= 0x8001FFFF) {
+    os << "Vendor specific 0x" << std::setw(8) << std::setfill('0') << std::hex
+       << code << std::setfill(' ');
+  }
+  switch (code) {
+  case 0x0001000C:
+    os << "AES-256-CBC-HMAC-SHA-1";
+    break;
+  case 0x00010010:
+    os << "AES-256-CCM-128";
+    break;
+  case 0x00010014:
+    os << "AES-256-GCM-128";
+    break;
+  case 0x00010016:
+    os << "AES-256-XTS-HMAC-SHA-512";
+    break;
+  default:
+    os << "Unknown 0x" << std::setw(8) << std::setfill('0') << std::hex << code
+       << std::setfill(' ');
+  }
+}
+
+void print_algorithms(std::ostream& os, const page_dec& page)
+{
+  os << "Supported algorithms:\n";
+
+  for (const scsi::algorithm_descriptor& ad: scsi::read_algorithms(page)) {
+    os << std::left << std::setw(5)
+       << static_cast<unsigned int>(ad.algorithm_index);
+    print_algorithm_name(os, ntohl(ad.security_algorithm_code));
+    os.put('\n');
+
+    // Print KAD capabilities and size
+    auto dkad_c {static_cast<unsigned int>(
+        ad.flags3 & scsi::algorithm_descriptor::flags3_dkad_c_mask)};
+    if (dkad_c == 2u << scsi::algorithm_descriptor::flags3_dkad_c_pos) {
+      os << std::left << std::setw(5) << ""
+         << "Key descriptors not allowed\n";
+    } else if (dkad_c) {
+      os << std::left << std::setw(5) << "";
+      if (dkad_c == 1u << scsi::algorithm_descriptor::flags3_dkad_c_pos) {
+        os << "Key descriptors required, ";
+      } else {
+        os << "Key descriptors allowed, ";
+      }
+      if ((ad.flags2 & scsi::algorithm_descriptor::flags2_ukadf_mask) ==
+          scsi::algorithm_descriptor::flags2_ukadf_mask) {
+        os << "fixed ";
+      } else {
+        os << "maximum ";
+      }
+      os << std::dec << ntohs(ad.maximum_ukad_length) << " bytes\n";
+    }
+
+    // Print raw decryption mode capability:
+    auto rdmc_c {static_cast<unsigned int>(
+        ad.flags3 & scsi::algorithm_descriptor::flags3_rdmc_c_mask)};
+    switch (rdmc_c) {
+    case 1u << scsi::algorithm_descriptor::flags3_rdmc_c_pos:
+    case 6u << scsi::algorithm_descriptor::flags3_rdmc_c_pos:
+      os << std::left << std::setw(5) << "";
+      os << "Raw decryption mode not allowed\n";
+      break;
+    case 4u << scsi::algorithm_descriptor::flags3_rdmc_c_pos:
+    case 5u << scsi::algorithm_descriptor::flags3_rdmc_c_pos:
+    case 7u << scsi::algorithm_descriptor::flags3_rdmc_c_pos:
+      os << std::left << std::setw(5) << "";
+      os << "Raw decryption mode allowed, raw read ";
+      if (rdmc_c == 4u << scsi::algorithm_descriptor::flags3_rdmc_c_pos) {
+        os << "disabled by default\n";
+      } else {
+        os << "enabled by default\n";
+      }
+      break;
+    }
+  }
+}
+
 std::vector<std::reference_wrapper<const algorithm_descriptor>>
 read_algorithms(const page_dec& page)
 {
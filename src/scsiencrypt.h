@@ -22,10 +22,12 @@ GNU General Public License for more details.
 
 #include <array>
 #include <bitset>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -81,6 +83,27 @@ inline std::ostream& operator<<(std::ostream& os, decrypt_mode m)
   return os;
 }
 
+// which I_T nexuses (host connections) data encryption parameters apply to
+enum class nexus_scope : std::uint8_t {
+  public_scope = 0u, // parameters shared by all nexuses using public scope
+  local = 1u,        // only the nexus that set the parameters
+  all_it_nexus = 2u, // all nexuses, replacing their parameters
+};
+
+inline std::ostream& operator<<(std::ostream& os, nexus_scope s)
+{
+  if (s == nexus_scope::public_scope) {
+    os << "public";
+  } else if (s == nexus_scope::local) {
+    os << "local";
+  } else if (s == nexus_scope::all_it_nexus) {
+    os << "all";
+  } else {
+    os << "unknown";
+  }
+  return os;
+}
+
 enum class kad_type : std::uint8_t {
   ukad = 0u,  // unauthenticated key-associated data
   akad = 1u,  // authenticated key-associated data
@@ -144,6 +167,12 @@ struct __attribute__((packed)) page_des {
   std::uint16_t asdk_count;
   std::byte reserved[8];
   kad kads[];
+
+  nexus_scope it_nexus_scope() const
+  {
+    return static_cast<nexus_scope>(std::to_integer<std::uint8_t>(
+        (scope & scope_it_nexus_mask) >> scope_it_nexus_pos));
+  }
 };
 static_assert(sizeof(page_des) == 24u);
 
@@ -378,20 +407,91 @@ static_assert(sizeof(sense_data) == 18u);
 // std::unique_ptr does not allow construction of fixed-sized arrays
 using sense_buffer = std::array<std::uint8_t, sense_data::maximum_size>;
 
+// Sense data in fixed (70h, 71h) or descriptor (72h, 73h) format, decoded
+// in place. Fields the sense data does not carry read as zero or empty.
+class sense_view {
+public:
+  sense_view(const std::uint8_t *data, std::size_t length) noexcept;
+
+  // response code 70h to 73h
+  bool valid() const noexcept;
+  bool descriptor_format() const noexcept;
+  // error of an earlier command (71h, 73h)
+  bool deferred() const noexcept;
+  std::byte sense_key() const noexcept;
+  std::uint8_t asc() const noexcept;
+  std::uint8_t ascq() const noexcept;
+  std::optional<std::uint64_t> information() const noexcept;
+  // progress of an operation in progress, in 65536ths, with sense key
+  // NO SENSE or NOT READY
+  std::optional<std::uint16_t> progress() const noexcept;
+
+  const std::uint8_t *data() const noexcept { return p; }
+  // bytes of sense data, including the additional sense bytes
+  std::size_t size() const noexcept { return length; }
+
+private:
+  std::uint8_t byte(std::size_t i) const noexcept
+  {
+    return i < length ? p[i] : 0u;
+  }
+  // offset of the first descriptor of type, or 0 if there is none
+  std::size_t find_descriptor(std::uint8_t type) const noexcept;
+
+  const std::uint8_t *p;
+  std::size_t length;
+};
+
 class scsi_error : public std::runtime_error {
 public:
   explicit scsi_error(std::unique_ptr<sense_buffer>&& buf)
       : std::runtime_error {"SCSI I/O error"}, sense_buf {std::move(buf)}
   {}
-  const sense_data& get_sense() const
+  sense_view sense() const noexcept
   {
-    return reinterpret_cast<sense_data&>(*sense_buf->data());
+    return {sense_buf->data(), sense_buf->size()};
   }
 
 private:
   std::unique_ptr<sense_buffer> sense_buf;
 };
 
+// RESERVATION CONFLICT status: the command was refused because another
+// initiator holds a reservation on the device. Carries no sense data.
+class reservation_conflict : public std::runtime_error {
+public:
+  reservation_conflict()
+      : std::runtime_error {"Device is reserved by another initiator"}
+  {}
+};
+
+// The command did not reach the device or its response was lost, e.g. due
+// to a failed link or HBA. Another path to the device may still work.
+class transport_error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// PERSISTENT RESERVE IN parameter data for the READ RESERVATION service
+// action. additional_length is zero when no persistent reservation is held.
+struct __attribute__((packed)) reservation_data {
+  std::uint32_t generation;
+  std::uint32_t additional_length;
+  std::uint8_t reservation_key[8];
+  std::byte obsolete1[4];
+  std::byte reserved;
+  std::byte scope_type;
+  static constexpr auto scope_type_scope_pos {4u};
+  static constexpr std::byte scope_type_scope_mask {15u
+                                                    << scope_type_scope_pos};
+  static constexpr auto scope_type_type_pos {0u};
+  static constexpr std::byte scope_type_type_mask {15u << scope_type_type_pos};
+  std::byte obsolete2[2];
+
+  static constexpr std::size_t header_size {8u};
+};
+static_assert(sizeof(reservation_data) == 24u);
+
 // Extract pointers to kad structures within a variable-length page.
 // Page must have a page_header layout
 template <typename Page>
@@ -410,6 +510,34 @@ std::vector<std::reference_wrapper<const kad>> read_page_kads(const Page& page)
   return v;
 }
 
+// Counters of the device handle pool, see set_session_capacity
+struct session_stats {
+  std::uint64_t hits;      // commands sent through a pooled handle
+  std::uint64_t misses;    // commands that had to open the device
+  std::uint64_t evictions; // handles closed to stay within the capacity
+  std::size_t open;        // handles currently pooled
+};
+
+// Keep up to capacity device handles open between commands, closing the
+// least recently used one when another is needed. With the default of 0,
+// each command opens and closes the device. Note that st devices can be
+// opened only once at a time, so pooled handles keep other programs from
+// opening them until closed. The pool is shared by the whole process and
+// safe to use from several threads.
+void set_session_capacity(std::size_t capacity);
+// On Linux, have is_device_ready ask the st driver whether a tape is
+// loaded, which saves a TEST UNIT READY, when the device is an st device.
+// The driver last checked when the device was opened. Has no effect on
+// other devices or systems.
+void set_driver_status(bool enable) noexcept;
+// Close the pooled handle of device, if any
+void close_session(const std::string& device);
+session_stats get_session_stats();
+// Set the stream receiving SCSI command and response dumps in builds
+// configured --with-scsi-debug. Applies to the calling thread only, so
+// threads working on different devices can log separately. Defaults to
+// std::cerr; nullptr disables the dumps.
+void set_debug_output(std::ostream *os) noexcept;
 // Check if a tape is loaded
 bool is_device_ready(const std::string& device);
 // Get SCSI inquiry data from device
@@ -423,6 +551,16 @@ void get_nbes(const std::string& device, std::uint8_t *buffer,
 // Get device encryption capabilities
 void get_dec(const std::string& device, std::uint8_t *buffer,
              std::size_t length);
+// Get the device identification VPD page (83h)
+void get_device_identification(const std::string& device,
+                               std::uint8_t *buffer, std::size_t length);
+// Return the designator that best identifies the logical unit in a device
+// identification VPD page, e.g. "naa.50014380272a1a3c", or an empty string
+// if there is none. Ports of a multi-port drive report the same designator.
+std::string logical_unit_designator(const std::uint8_t *page,
+                                    std::size_t length);
+// Get the persistent reservation held on device, if any
+reservation_data get_reservation(const std::string& device);
 // Fill out a set data encryption page with parameters.
 // Result is allocated and returned as a std::unique_ptr and should
 // be sent to the device using scsi::write_sde
@@ -430,12 +568,31 @@ std::unique_ptr<const std::uint8_t[]>
 make_sde(encrypt_mode enc_mode, decrypt_mode dec_mode,
          std::uint8_t algorithm_index, const std::vector<std::uint8_t>& key,
          const std::string& key_name, kadf key_format, sde_rdmc rdmc,
-         bool ckod);
-// Write set data encryption parameters to device
-void write_sde(const std::string& device, const std::uint8_t *sde_buffer);
-void print_sense_data(std::ostream& os, const sense_data& sd);
+         bool ckod, bool ckorp = false, bool ckorl = false,
+         nexus_scope scope = nexus_scope::all_it_nexus);
+// Fill out a set data encryption page in a caller provided buffer of
+// length bytes, e.g. a locked key slot, and return the size of the page.
+// Throws std::length_error if the page does not fit.
+std::size_t make_sde(std::uint8_t *buffer, std::size_t length,
+                     encrypt_mode enc_mode, decrypt_mode dec_mode,
+                     std::uint8_t algorithm_index, const std::uint8_t *key,
+                     std::size_t key_length, const std::string& key_name,
+                     kadf key_format, sde_rdmc rdmc, bool ckod,
+                     bool ckorp = false, bool ckorl = false,
+                     nexus_scope scope = nexus_scope::all_it_nexus);
+// Write set data encryption parameters to device, waiting up to timeout
+// for the command to complete, or the default timeout if zero
+void write_sde(const std::string& device, const std::uint8_t *sde_buffer,
+               std::chrono::milliseconds timeout = {});
+void print_sense_data(std::ostream& os, const sense_view& sense);
+// Print the holder key and type of a persistent reservation
+void print_reservation(std::ostream& os, const reservation_data& rd);
 std::vector<std::reference_wrapper<const algorithm_descriptor>>
 read_algorithms(const page_dec& page);
+// Print the name of a security algorithm code
+void print_algorithm_name(std::ostream& os, const std::uint32_t code);
+// Print the algorithms listed in a device encryption capabilities page
+void print_algorithms(std::ostream& os, const page_dec& page);
 
 } // namespace scsi
 
@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2022 stenc authors
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/*
+Interface of hook libraries loaded with stenc --hook. A hook library is a
+shared object exporting one or both of the functions declared below. They
+run inside the stenc process on a worker thread, and may be called
+concurrently for different drives. A call that does not return within the
+hook timeout is abandoned and its thread left running, so hooks must not
+rely on being called again after a timeout.
+
+Optionally, the library may export
+    const unsigned int stenc_hook_api_version = STENC_HOOK_API_VERSION;
+in which case stenc refuses to load it if the versions differ.
+
+All pointers passed to hooks are valid only for the duration of the call.
+*/
+
+#ifndef _STENC_HOOK_H
+#define _STENC_HOOK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STENC_HOOK_API_VERSION 1u
+
+/* Encryption state of a drive as reported by the device */
+struct stenc_hook_drive {
+  const char *device;   /* device node the commands were sent to */
+  const char *vendor;   /* inquiry identity, trailing spaces removed */
+  const char *product;
+  const char *revision;
+  int des_valid;        /* nonzero if the fields below are valid */
+  int encryption_mode;  /* 0 off, 1 external, 2 on */
+  int decryption_mode;  /* 0 off, 1 raw, 2 on, 3 mixed */
+  unsigned int algorithm_index;
+  unsigned long key_instance_counter;
+  const char *key_descriptor; /* uKAD, "" if none */
+  int key_scope;              /* 0 public, 1 local, 2 all I_T nexus */
+};
+
+struct stenc_hook_change {
+  unsigned int api_version;            /* STENC_HOOK_API_VERSION */
+  const char *key_descriptor;          /* descriptor being set, "" if none */
+  const struct stenc_hook_drive *before;
+  const struct stenc_hook_drive *after; /* NULL before the change */
+};
+
+/* Called before encryption settings are changed. Return 0 to go ahead,
+   anything else to cancel the change on this drive. */
+int stenc_hook_pre_change(const struct stenc_hook_change *change);
+/* Called after encryption settings were changed successfully */
+void stenc_hook_post_change(const struct stenc_hook_change *change);
+
+typedef int (*stenc_hook_pre_change_fn)(const struct stenc_hook_change *);
+typedef void (*stenc_hook_post_change_fn)(const struct stenc_hook_change *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <string>
+
+#include <unistd.h>
+
+#include "activity.h"
+#include "config.h"
+
+using namespace std::literals::string_literals;
+using namespace std::literals::chrono_literals;
+
+/**
+ * Check that st driver statistics are read, and that devices without them
+ * are taken to be idle.
+ */
+TEST_CASE("Read st statistics", "[activity]")
+{
+  char dir_template[] {"/tmp/stenc-activity.XXXXXX"};
+  REQUIRE(mkdtemp(dir_template) != nullptr);
+  const std::string dir {dir_template};
+
+  std::ofstream {dir + "/read_cnt"} << "12\n";
+  std::ofstream {dir + "/write_cnt"} << "3456789\n";
+  std::ofstream {dir + "/other_cnt"} << "7\n";
+  REQUIRE_FALSE(stenc::read_io_counters(dir));
+
+  std::ofstream {dir + "/in_flight"} << "1\n";
+  auto counters {stenc::read_io_counters(dir)};
+  REQUIRE(counters);
+  REQUIRE(counters->read_cnt == 12u);
+  REQUIRE(counters->write_cnt == 3456789u);
+  REQUIRE(counters->other_cnt == 7u);
+  REQUIRE(counters->in_flight == 1u);
+
+  for (auto name: {"/read_cnt", "/write_cnt", "/other_cnt", "/in_flight"}) {
+    REQUIRE(unlink((dir + name).c_str()) == 0);
+  }
+  REQUIRE(rmdir(dir.c_str()) == 0);
+}
+
+TEST_CASE("Devices without st statistics", "[activity]")
+{
+  REQUIRE(stenc::stats_dir_of("/nonexistent/nst0"s).empty());
+  REQUIRE(stenc::stats_dir_of("/dev/null"s).empty());
+  REQUIRE_FALSE(stenc::is_drive_busy("/dev/null"s, 0ms));
+}
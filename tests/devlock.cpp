@@ -0,0 +1,97 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <chrono>
+#include <string>
+#include <system_error>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "devlock.h"
+
+using namespace std::literals::string_literals;
+using namespace std::literals::chrono_literals;
+
+/**
+ * Check that per-drive locks are keyed by device and that shared and
+ * exclusive holders exclude each other as expected.
+ */
+TEST_CASE("Lock key of non-device paths", "[devlock]")
+{
+  REQUIRE(stenc::device_lock_key("/nonexistent/nst0"s) ==
+          "path-_nonexistent_nst0"s);
+}
+
+TEST_CASE("Shared and exclusive locks", "[devlock]")
+{
+  char dir_template[] {"/tmp/stenc-devlock.XXXXXX"};
+  REQUIRE(mkdtemp(dir_template) != nullptr);
+  const std::string dir {dir_template};
+  const std::string device {"/dev/null"};
+  const auto path {dir + "/stenc-" + stenc::device_lock_key(device) + ".lock"};
+
+  {
+    stenc::device_lock first {device, stenc::lock_mode::shared, 0ms, dir};
+    REQUIRE(first.held());
+    stenc::device_lock second {device, stenc::lock_mode::shared, 0ms, dir};
+    REQUIRE(second.held());
+    REQUIRE_THROWS_AS(
+        stenc::device_lock(device, stenc::lock_mode::exclusive, 20ms, dir),
+        std::runtime_error);
+  }
+  {
+    stenc::device_lock exclusive {device, stenc::lock_mode::exclusive, 0ms,
+                                  dir};
+    REQUIRE(exclusive.held());
+    REQUIRE_THROWS_AS(
+        stenc::device_lock(device, stenc::lock_mode::shared, 0ms, dir),
+        std::runtime_error);
+  }
+  stenc::device_lock again {device, stenc::lock_mode::exclusive, 0ms, dir};
+  REQUIRE(again.held());
+
+  REQUIRE(unlink(path.c_str()) == 0);
+  REQUIRE(rmdir(dir.c_str()) == 0);
+}
+
+TEST_CASE("Lock files are created safely", "[devlock]")
+{
+  char dir_template[] {"/tmp/stenc-devlock.XXXXXX"};
+  REQUIRE(mkdtemp(dir_template) != nullptr);
+  const std::string dir {dir_template};
+  const std::string device {"/dev/null"};
+  const auto path {dir + "/stenc-" + stenc::device_lock_key(device) + ".lock"};
+
+  {
+    // other users can take the lock whatever the umask
+    const auto mask {umask(077)};
+    stenc::device_lock lock {device, stenc::lock_mode::shared, 0ms, dir};
+    umask(mask);
+    REQUIRE(lock.held());
+    struct stat st {};
+    REQUIRE(stat(path.c_str(), &st) == 0);
+    REQUIRE((st.st_mode & 0777) == 0644);
+  }
+  REQUIRE(unlink(path.c_str()) == 0);
+
+  // a link planted in place of the lock file is not followed
+  REQUIRE(symlink("/dev/null", path.c_str()) == 0);
+  REQUIRE_THROWS_AS(
+      stenc::device_lock(device, stenc::lock_mode::shared, 0ms, dir),
+      std::system_error);
+  REQUIRE(unlink(path.c_str()) == 0);
+
+  // nor is a directory others may write to used at all
+  REQUIRE(chmod(dir.c_str(), 0777) == 0);
+  {
+    stenc::device_lock lock {device, stenc::lock_mode::shared, 0ms, dir};
+    REQUIRE_FALSE(lock.held());
+  }
+  REQUIRE(rmdir(dir.c_str()) == 0);
+}
@@ -0,0 +1,94 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <sstream>
+#include <string>
+
+#include "config.h"
+#include "events.h"
+
+using namespace std::literals::string_literals;
+
+static stenc::drive_state loaded_drive()
+{
+  stenc::drive_state state;
+  state.device = "/dev/nst0"s;
+  state.des_valid = true;
+  state.encryption_mode = scsi::encrypt_mode::on;
+  state.decryption_mode = scsi::decrypt_mode::on;
+  state.algorithm_index = 1u;
+  state.key_instance_counter = 5u;
+  state.ukad = "POOL-A"s;
+  state.volume = stenc::volume_state::encrypted;
+  return state;
+}
+
+/**
+ * Check that changes between drive states are reported as typed events,
+ * and that states which could not be fully queried do not cause events.
+ */
+TEST_CASE("Events for drive state changes", "[events]")
+{
+  const auto before {loaded_drive()};
+  REQUIRE(stenc::diff_states(before, before).empty());
+
+  auto after {before};
+  after.ukad = "POOL-B"s;
+  after.key_instance_counter = 6u;
+  auto events {stenc::diff_states(before, after)};
+  REQUIRE(events.size() == 2u);
+  REQUIRE(events[0].type == stenc::event_type::des);
+  REQUIRE(events[0].detail == "enc=on,dec=on,alg=1,ukad=POOL-B"s);
+  REQUIRE(events[1].type == stenc::event_type::kic);
+  REQUIRE(events[1].detail == "6"s);
+
+  after = before;
+  after.volume = stenc::volume_state::no_media;
+  events = stenc::diff_states(before, after);
+  REQUIRE(events.size() == 1u);
+  REQUIRE(events[0].type == stenc::event_type::media);
+  REQUIRE(events[0].detail == "removed"s);
+
+  events = stenc::diff_states(after, before);
+  REQUIRE(events.size() == 2u);
+  REQUIRE(events[0].detail == "loaded"s);
+  REQUIRE(events[1].type == stenc::event_type::volume);
+  REQUIRE(events[1].detail == "encrypted"s);
+
+  // volume status is not queried on busy drives
+  after = before;
+  after.volume = stenc::volume_state::busy;
+  REQUIRE(stenc::diff_states(before, after).empty());
+
+  after = before;
+  after.error = "Inappropriate ioctl for device"s;
+  events = stenc::diff_states(before, after);
+  REQUIRE(events.size() == 1u);
+  REQUIRE(events[0].type == stenc::event_type::health);
+  REQUIRE(events[0].detail == "error: Inappropriate ioctl for device"s);
+  events = stenc::diff_states(after, before);
+  REQUIRE(events.size() == 1u);
+  REQUIRE(events[0].detail == "ok"s);
+}
+
+TEST_CASE("Event type filters and output", "[events]")
+{
+  auto mask {stenc::parse_event_mask("kic,media"s)};
+  REQUIRE(mask);
+  REQUIRE(*mask & stenc::mask_of(stenc::event_type::kic));
+  REQUIRE(*mask & stenc::mask_of(stenc::event_type::media));
+  REQUIRE_FALSE(*mask & stenc::mask_of(stenc::event_type::des));
+  REQUIRE(stenc::parse_event_mask("des,kic,media,volume,health"s) ==
+          stenc::all_events);
+  REQUIRE_FALSE(stenc::parse_event_mask("kic,tape"s));
+  REQUIRE_FALSE(stenc::parse_event_mask(""s));
+
+  std::ostringstream oss;
+  stenc::print_event(oss, {"/dev/nst0"s, stenc::event_type::kic, "6"s},
+                     1760745600);
+  REQUIRE(oss.str() == "2025-10-18T00:00:00Z /dev/nst0 kic 6\n"s);
+}
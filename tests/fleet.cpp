@@ -0,0 +1,85 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "fleet.h"
+
+using namespace std::literals::string_literals;
+
+static std::vector<stenc::drive_state> make_fleet(std::size_t n)
+{
+  std::vector<stenc::drive_state> states(n);
+  for (std::size_t i = 0; i < n; i++) {
+    auto& state {states[i]};
+    state.device = "/dev/sg"s + std::to_string(i);
+    state.des_valid = i % 100u != 99u;
+    state.encryption_mode =
+        i % 2u ? scsi::encrypt_mode::on : scsi::encrypt_mode::off;
+    state.decryption_mode =
+        i % 2u ? scsi::decrypt_mode::on : scsi::decrypt_mode::off;
+    state.algorithm_index = 1u;
+    state.ukad = i % 4u == 1u ? "POOL-A  "s : ""s;
+    state.volume = i % 3u ? stenc::volume_state::encrypted
+                          : stenc::volume_state::no_media;
+    if (!state.des_valid) {
+      state.error = "Transport error on all paths"s;
+    }
+  }
+  return states;
+}
+
+/**
+ * Check that drives are selected by their state, and that drives whose
+ * encryption status could not be read match no encryption setting.
+ */
+TEST_CASE("Select drives by state", "[fleet]")
+{
+  const auto states {make_fleet(10000u)};
+  const stenc::fleet_state fleet {states};
+  REQUIRE(fleet.size() == 10000u);
+
+  auto selected {fleet.select(*stenc::parse_fleet_query("enc=off"s))};
+  // even drives, less those at 99 mod 100, which are all odd
+  REQUIRE(selected.size() == 5000u);
+  for (auto i: selected) {
+    REQUIRE(states[i].encryption_mode == scsi::encrypt_mode::off);
+  }
+
+  selected = fleet.select(*stenc::parse_fleet_query("enc=on,health=ok"s));
+  REQUIRE(selected.size() == 4900u);
+
+  selected = fleet.select(*stenc::parse_fleet_query("health=error"s));
+  REQUIRE(selected.size() == 100u);
+  REQUIRE(selected.front() == 99u);
+
+  selected = fleet.select(*stenc::parse_fleet_query("ukad=POOL-A"s));
+  REQUIRE(selected.size() == 2500u);
+  REQUIRE(selected.front() == 1u);
+
+  selected = fleet.select(*stenc::parse_fleet_query("media=no,enc=on"s));
+  for (auto i: selected) {
+    REQUIRE(i % 3u == 0u);
+    REQUIRE(i % 2u == 1u);
+  }
+
+  REQUIRE(fleet.select(stenc::fleet_query {}).size() == 10000u);
+  REQUIRE(fleet.select(*stenc::parse_fleet_query("alg=2"s)).empty());
+}
+
+TEST_CASE("Parse drive filters", "[fleet]")
+{
+  REQUIRE(stenc::parse_fleet_query("health=ok"s)->healthy == true);
+  REQUIRE(stenc::parse_fleet_query("dec=mixed,health=error"s)->healthy ==
+          false);
+  REQUIRE(stenc::parse_fleet_query("dec=mixed"s)->state.dec_mode ==
+          scsi::decrypt_mode::mixed);
+  REQUIRE_FALSE(stenc::parse_fleet_query("health=maybe"s));
+  REQUIRE_FALSE(stenc::parse_fleet_query("host=3"s));
+}
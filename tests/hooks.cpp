@@ -0,0 +1,101 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include "config.h"
+#include "hooks.h"
+
+using namespace std::literals::string_literals;
+using namespace std::literals::chrono_literals;
+
+static std::string seen_device;
+static std::string seen_descriptor;
+static unsigned long seen_kic;
+static bool seen_after;
+
+static int veto_pool_b(const stenc_hook_change *change)
+{
+  seen_device = change->before->device;
+  seen_descriptor = change->key_descriptor;
+  seen_after = change->after != nullptr;
+  return seen_descriptor == "POOL-B"s;
+}
+
+static void record_post(const stenc_hook_change *change)
+{
+  seen_kic = change->after->key_instance_counter;
+}
+
+// hang blocks until the test releases it, then reports that it finished
+static std::mutex hang_mutex;
+static std::condition_variable hang_cv;
+static bool hang_released;
+static bool hang_finished;
+
+static int hang(const stenc_hook_change *)
+{
+  std::unique_lock lock {hang_mutex};
+  hang_cv.wait(lock, [] { return hang_released; });
+  hang_finished = true;
+  hang_cv.notify_all();
+  return 0;
+}
+
+/**
+ * Check that hook functions receive the decoded drive state and that
+ * hooks are abandoned after their timeout.
+ */
+TEST_CASE("Hooks receive drive state", "[hooks]")
+{
+  stenc::drive_state before {};
+  before.device = "/dev/nst0";
+  before.des_valid = true;
+  before.key_instance_counter = 4u;
+  auto after {before};
+  after.key_instance_counter = 5u;
+  std::ostringstream err;
+
+  auto hooks {stenc::make_change_hooks({veto_pool_b, record_post}, 1000ms)};
+  REQUIRE(hooks.pre(before, "POOL-A"s, err));
+  REQUIRE(seen_device == "/dev/nst0"s);
+  REQUIRE(seen_descriptor == "POOL-A"s);
+  REQUIRE(!seen_after);
+  REQUIRE(!hooks.pre(before, "POOL-B"s, err));
+
+  hooks.post(before, after, "POOL-A"s, err);
+  REQUIRE(seen_kic == 5u);
+  REQUIRE(err.str().empty());
+}
+
+TEST_CASE("Hooks time out", "[hooks]")
+{
+  stenc::drive_state before {};
+  before.device = "/dev/nst0";
+  std::ostringstream err;
+
+  auto hooks {stenc::make_change_hooks({hang, nullptr}, 20ms)};
+  REQUIRE(!hooks.post);
+  REQUIRE(!hooks.pre(before, ""s, err));
+  REQUIRE(err.str() == "stenc: Pre-change hook timed out for /dev/nst0\n"s);
+
+  // let the abandoned call finish before the test exits
+  std::unique_lock lock {hang_mutex};
+  hang_released = true;
+  hang_cv.notify_all();
+  hang_cv.wait(lock, [] { return hang_finished; });
+}
+
+TEST_CASE("Missing hook library", "[hooks]")
+{
+  REQUIRE_THROWS_AS(stenc::load_hooks("/nonexistent/libhook.so"s),
+                    std::runtime_error);
+}
@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <cstring>
+#include <new>
+
+#include "config.h"
+#include "keyarena.h"
+
+/**
+ * Check that key slots are handed out from a fixed pool and come back
+ * wiped.
+ */
+TEST_CASE("Key slots are wiped on release", "[keyarena]")
+{
+  stenc::key_arena arena {2u};
+
+  auto slot {arena.acquire()};
+  REQUIRE(slot);
+  std::memset(slot.data(), 0xaa, stenc::key_slot::capacity);
+  slot.resize(32u);
+  REQUIRE(slot.size() == 32u);
+  auto p {slot.data()};
+  slot.release();
+  REQUIRE(!slot);
+
+  // the most recently released slot is handed out again
+  auto again {arena.acquire()};
+  REQUIRE(again.data() == p);
+  for (std::size_t i = 0; i < stenc::key_slot::capacity; i++) {
+    REQUIRE(again.data()[i] == 0u);
+  }
+  REQUIRE_THROWS_AS(again.resize(stenc::key_slot::capacity + 1u),
+                    std::length_error);
+}
+
+TEST_CASE("Key arena does not grow", "[keyarena]")
+{
+  stenc::key_arena arena {2u};
+
+  auto first {arena.acquire()};
+  auto second {arena.acquire()};
+  REQUIRE_THROWS_AS(arena.acquire(), std::bad_alloc);
+
+  auto moved {std::move(first)};
+  REQUIRE(!first);
+  moved.release();
+  REQUIRE(arena.acquire());
+}
@@ -0,0 +1,68 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <chrono>
+#include <sstream>
+#include <string>
+
+#include "config.h"
+#include "multipath.h"
+
+using namespace std::literals::string_literals;
+using namespace std::literals::chrono_literals;
+
+/**
+ * Check that paths to the same drive are grouped, fastest first, and that
+ * operations move on to the next path on transport errors only.
+ */
+TEST_CASE("Group paths by drive", "[multipath]")
+{
+  const std::vector<stenc::path_probe> probes {
+      {"/dev/sg1", "naa.5000e11156304001", 900us},
+      {"/dev/sg2", "naa.5000e11156304002", 300us},
+      {"/dev/sg3", "", 0us},
+      {"/dev/sg4", "naa.5000e11156304001", 200us},
+      {"/dev/sg5", "", 0us},
+  };
+  auto drives {stenc::group_paths(probes)};
+
+  REQUIRE(drives.size() == 4u);
+  REQUIRE(drives[0].identifier == "naa.5000e11156304001"s);
+  REQUIRE(drives[0].paths ==
+          std::vector<std::string> {"/dev/sg4"s, "/dev/sg1"s});
+  REQUIRE(drives[1].paths == std::vector<std::string> {"/dev/sg2"s});
+  REQUIRE(drives[2].paths == std::vector<std::string> {"/dev/sg3"s});
+  REQUIRE(drives[3].paths == std::vector<std::string> {"/dev/sg5"s});
+}
+
+TEST_CASE("Fail over on transport errors", "[multipath]")
+{
+  const stenc::drive_paths drive {"naa.5000e11156304001",
+                                  {"/dev/sg4"s, "/dev/sg1"s}};
+  std::ostringstream err;
+  std::vector<std::string> tried;
+
+  REQUIRE(stenc::with_failover(drive, err, [&](const std::string& device) {
+    tried.push_back(device);
+    if (device == "/dev/sg4"s) {
+      throw scsi::transport_error {"Transport error on /dev/sg4"};
+    }
+  }));
+  REQUIRE(tried == drive.paths);
+  REQUIRE(err.str() == "stenc: Transport error on /dev/sg4\n"
+                       "Retrying through /dev/sg1\n");
+
+  REQUIRE(!stenc::with_failover(drive, err, [](const std::string& device) {
+    throw scsi::transport_error {"Transport error on " + device};
+  }));
+  REQUIRE_THROWS_AS(
+      stenc::with_failover(drive, err,
+                           [](const std::string&) {
+                             throw std::runtime_error {"Device not ready"};
+                           }),
+      std::runtime_error);
+}
@@ -14,6 +14,18 @@
 
 using namespace std::literals::string_literals;
 
+static std::optional<std::vector<std::uint8_t>>
+key_from_hex_chars(const std::string& s)
+{
+  std::vector<std::uint8_t> bytes(s.size() / 2 + 1);
+  if (auto count {
+          key_from_hex_chars(s.data(), s.size(), bytes.data(), bytes.size())}) {
+    bytes.resize(*count);
+    return bytes;
+  }
+  return {};
+}
+
 TEST_CASE("Test key_from_hex_chars", "[output]")
 {
   REQUIRE(key_from_hex_chars(""s) == std::vector<std::uint8_t> {});
@@ -28,6 +40,12 @@ TEST_CASE("Test key_from_hex_chars", "[output]")
   REQUIRE(key_from_hex_chars("0123456789ABCDEF"s) ==
           std::vector<std::uint8_t> {0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd,
                                      0xef});
+
+  std::uint8_t small[2];
+  REQUIRE(key_from_hex_chars("abcd", 4, small, sizeof(small)) == 2u);
+  REQUIRE(key_from_hex_chars("abcdef", 6, small, sizeof(small)) ==
+          std::nullopt);
+  REQUIRE(key_from_hex_chars("abc", 3, small, 0u) == std::nullopt);
 }
 
 /**
@@ -59,6 +77,28 @@ Product Revision:        1234\n"s};
   REQUIRE(oss.str() == expected_output);
 }
 
+TEST_CASE("Test persistent reservation output", "[output]")
+{
+  const std::uint8_t response[] {
+      0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x10, 0x01, 0x23, 0x45, 0x67,
+      0x89, 0xab, 0xcd, 0xef, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00,
+  };
+  const std::string expected_output {"\
+Reservation Key:         0x0123456789abcdef\n\
+Reservation Type:        Exclusive Access (0x03)\n"s};
+  std::ostringstream oss;
+  scsi::print_reservation(
+      oss, reinterpret_cast<const scsi::reservation_data&>(response));
+  REQUIRE(oss.str() == expected_output);
+
+  const std::uint8_t none[sizeof(scsi::reservation_data)] {};
+  oss.str({});
+  scsi::print_reservation(
+      oss, reinterpret_cast<const scsi::reservation_data&>(none));
+  REQUIRE(oss.str() == "Reservation Holder:      "
+                       "Unknown, no persistent reservation\n");
+}
+
 TEST_CASE("SCSI get device encryption status output 1", "[output]")
 {
   const std::uint8_t page[] {
@@ -87,6 +127,7 @@ TEST_CASE("SCSI get device encryption status output 2", "[output]")
 Drive Output:            Decrypting\n\
                          Unencrypted data not outputted\n\
 Drive Input:             Encrypting\n\
+Key Scope:               All hosts\n\
 Key Instance Counter:    1\n\
 Encryption Algorithm:    1\n\
 Drive Key Desc.(uKAD):   Hello world!\n"s};
@@ -145,3 +186,80 @@ Supported algorithms:\n\
   print_algorithms(oss, reinterpret_cast<const scsi::page_dec&>(page));
   REQUIRE(oss.str() == expected_output);
 }
+
+TEST_CASE("Test status table output", "[output]")
+{
+  const std::uint8_t des[] {
+      0x00, 0x20, 0x00, 0x24, 0x42, 0x02, 0x02, 0x01, 0x00, 0x00,
+      0x00, 0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x48, 0x65,
+      0x6c, 0x6c, 0x6f, 0x20, 0x77, 0x6f, 0x72, 0x6c, 0x64, 0x21,
+  };
+  const std::uint8_t nbes[] {
+      0x00, 0x21, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+  };
+  std::vector<stenc::drive_state> states(2);
+  states[0].device = "/dev/nst0";
+  stenc::decode_des(states[0], reinterpret_cast<const scsi::page_des&>(des));
+  stenc::decode_nbes(states[0],
+                     reinterpret_cast<const scsi::page_nbes&>(nbes));
+  states[0].latency = std::chrono::microseconds {2500};
+  states[1].device = "/dev/nst1";
+  states[1].volume = stenc::volume_state::no_media;
+  states[1].latency = std::chrono::microseconds {1200};
+  states[1].error = "SCSI I/O error";
+
+  const std::vector<table_column> columns {
+      table_column::device, table_column::enc,     table_column::kic,
+      table_column::ukad,   table_column::volume,  table_column::latency,
+      table_column::health,
+  };
+  const std::string expected_output {"\
+DEVICE     ENC  KIC  UKAD          VOLUME         LATENCY  HEALTH\n\
+/dev/nst1  -    -    -             no media       1.2ms    error\n\
+/dev/nst0  on   1    Hello world!  not encrypted  2.5ms    ok\n"s};
+  std::ostringstream oss;
+  print_table(oss, states, columns, table_column::latency);
+  REQUIRE(oss.str() == expected_output);
+
+  states[0].ukad = "POOL-A    ";
+  REQUIRE(table_cell(states[0], table_column::ukad) == "POOL-A");
+  states[0].ukad.clear();
+  REQUIRE(table_cell(states[0], table_column::ukad) == "-");
+
+  REQUIRE(table_columns_from_list("device,kic"s) ==
+          std::vector<table_column> {table_column::device, table_column::kic});
+  REQUIRE(table_columns_from_list("device,bogus"s) == std::nullopt);
+  REQUIRE(table_columns_from_list(""s) == std::nullopt);
+}
+
+TEST_CASE("Test drive state checks", "[output]")
+{
+  const std::uint8_t page[] {
+      0x00, 0x20, 0x00, 0x24, 0x42, 0x02, 0x02, 0x01, 0x00, 0x00,
+      0x00, 0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x48, 0x65,
+      0x6c, 0x6c, 0x6f, 0x20, 0x77, 0x6f, 0x72, 0x6c, 0x64, 0x21,
+  };
+  auto& des {reinterpret_cast<const scsi::page_des&>(page)};
+
+  auto match {
+      stenc::parse_expectation("enc=on,dec=on,alg=1,ukad=Hello world!"s)};
+  REQUIRE(match);
+  REQUIRE(stenc::des_matches(des, *match));
+  REQUIRE(stenc::des_matches(des, *stenc::parse_expectation(
+                                      "ukad=Hello world!    "s)));
+  REQUIRE(!stenc::des_matches(des, *stenc::parse_expectation("enc=off"s)));
+  REQUIRE(!stenc::des_matches(des, *stenc::parse_expectation("dec=mixed"s)));
+  REQUIRE(!stenc::des_matches(des, *stenc::parse_expectation("alg=2"s)));
+  REQUIRE(!stenc::des_matches(des, *stenc::parse_expectation("ukad=POOL-A"s)));
+  REQUIRE(stenc::des_matches(des, *stenc::parse_expectation("scope=all"s)));
+  REQUIRE(!stenc::des_matches(des, *stenc::parse_expectation("scope=local"s)));
+  REQUIRE(stenc::parse_expectation("media=yes"s)->media_loaded == true);
+
+  REQUIRE(stenc::parse_expectation("enc=maybe"s) == std::nullopt);
+  REQUIRE(stenc::parse_expectation("alg=256"s) == std::nullopt);
+  REQUIRE(stenc::parse_expectation("kic=1"s) == std::nullopt);
+  REQUIRE(stenc::parse_expectation("enc"s) == std::nullopt);
+}
@@ -0,0 +1,124 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <sstream>
+#include <string>
+
+#include "config.h"
+#include "policy.h"
+
+using namespace std::literals::string_literals;
+
+/**
+ * Check that barcodes resolve to the exact rule, or else the longest
+ * matching prefix, and that malformed policies are rejected.
+ */
+TEST_CASE("Match barcodes against policy rules", "[policy]")
+{
+  std::istringstream in {"# pool    key file              settings\n"
+                         "*          none                  enc=off\n"
+                         "BK1*       /etc/stenc/a.key      enc=on,dec=on\n"
+                         "\n"
+                         "OFF*       /etc/stenc/b.key      dec=mixed,alg=1\n"
+                         "OFF2026*   /etc/stenc/c.key      # dated keys\n"
+                         "OFF2026A1  /etc/stenc/d.key      scope=local\n"};
+  const auto policy {stenc::read_policy(in)};
+  REQUIRE(policy.size() == 5u);
+
+  auto rule {policy.match("BK1234L8"s)};
+  REQUIRE(rule != nullptr);
+  REQUIRE(rule->key_file == "/etc/stenc/a.key"s);
+  REQUIRE(rule->settings.enc_mode == scsi::encrypt_mode::on);
+  REQUIRE(rule->settings.dec_mode == scsi::decrypt_mode::on);
+  REQUIRE(rule->line == 3u);
+
+  REQUIRE(policy.match("OFF123L8"s)->key_file == "/etc/stenc/b.key"s);
+  REQUIRE(policy.match("OFF123L8"s)->settings.algorithm_index == 1u);
+  REQUIRE(policy.match("OFF2026B"s)->key_file == "/etc/stenc/c.key"s);
+  REQUIRE(policy.match("OFF2026A1"s)->key_file == "/etc/stenc/d.key"s);
+  REQUIRE(policy.match("OFF2026A1"s)->settings.scope ==
+          scsi::nexus_scope::local);
+  REQUIRE(policy.match("OFF2026A10"s)->key_file == "/etc/stenc/c.key"s);
+  REQUIRE(policy.match("OFF"s)->key_file == "/etc/stenc/b.key"s);
+
+  // bytes absent from all patterns fall back to the last prefix matched
+  REQUIRE(policy.match("BK1-xyz"s)->key_file == "/etc/stenc/a.key"s);
+  REQUIRE(policy.match("CLN001L8"s)->key_file.empty());
+  REQUIRE(policy.match(""s)->settings.enc_mode == scsi::encrypt_mode::off);
+}
+
+TEST_CASE("Policy without catch-all rule", "[policy]")
+{
+  std::istringstream in {"A1 a.key\n"};
+  const auto policy {stenc::read_policy(in)};
+  REQUIRE(policy.match("A1"s) != nullptr);
+  REQUIRE(policy.match("A"s) == nullptr);
+  REQUIRE(policy.match("A12"s) == nullptr);
+  REQUIRE(policy.match("B1"s) == nullptr);
+}
+
+TEST_CASE("Match key descriptors and drives against policy rules",
+          "[policy]")
+{
+  std::istringstream in {"BK1*            /etc/stenc/a.key  enc=on\n"
+                         "ukad:BK1*       /etc/stenc/b.key  dec=on\n"
+                         "ukad:BK1-2026   /etc/stenc/c.key  dec=on\n"
+                         "drive:/dev/sg1  scope=local\n"
+                         "drive:/dev/nst* scope=all\n"};
+  const auto policy {stenc::read_policy(in)};
+
+  REQUIRE(policy.match("BK1-2026"s)->key_file == "/etc/stenc/a.key"s);
+  auto rule {policy.match(stenc::policy_key::ukad, "BK1-2026"s)};
+  REQUIRE(rule != nullptr);
+  REQUIRE(rule->key == stenc::policy_key::ukad);
+  REQUIRE(rule->key_file == "/etc/stenc/c.key"s);
+  REQUIRE(policy.match(stenc::policy_key::ukad, "BK1-2025"s)->key_file ==
+          "/etc/stenc/b.key"s);
+  REQUIRE(policy.match(stenc::policy_key::ukad, "OFF1"s) == nullptr);
+
+  rule = policy.match(stenc::policy_key::drive, "/dev/sg1"s);
+  REQUIRE(rule != nullptr);
+  REQUIRE(rule->key_file.empty());
+  REQUIRE(rule->settings.scope == scsi::nexus_scope::local);
+  REQUIRE(policy.match(stenc::policy_key::drive, "/dev/nst0"s)
+              ->settings.scope == scsi::nexus_scope::all_it_nexus);
+  REQUIRE(policy.match(stenc::policy_key::drive, "/dev/sg10"s) == nullptr);
+  // each kind of rule only matches its own kind of value
+  REQUIRE(policy.match("/dev/sg1"s) == nullptr);
+}
+
+TEST_CASE("Many policy rules", "[policy]")
+{
+  std::ostringstream text;
+  for (int i = 0; i < 5000; i++) {
+    text << "P" << i << "* " << i << ".key\n";
+  }
+  std::istringstream in {text.str()};
+  const auto policy {stenc::read_policy(in)};
+  REQUIRE(policy.size() == 5000u);
+  REQUIRE(policy.match("P4999L8"s)->key_file == "4999.key"s);
+  REQUIRE(policy.match("P12L8"s)->key_file == "12.key"s);
+  REQUIRE(policy.match("P1234"s)->key_file == "1234.key"s);
+}
+
+TEST_CASE("Reject malformed policies", "[policy]")
+{
+  auto rejects {[](const std::string& text) {
+    std::istringstream in {text};
+    REQUIRE_THROWS_AS(stenc::read_policy(in), std::runtime_error);
+  }};
+  rejects("BK1*\n");
+  rejects("BK*1 a.key\n");
+  rejects("BK1* a.key\nBK1* b.key\n");
+  rejects("BK1* a.key enc=maybe\n");
+  rejects("BK1* a.key media=yes\n");
+  rejects("BK1* a.key enc=on extra\n");
+  rejects("drive:/dev/sg1\n");
+  rejects("drive:/dev/sg1 a.key\n");
+  rejects("drive:/dev/sg1 enc=on,scope=local\n");
+  rejects("ukad:* a.key\nukad:* b.key\n");
+}
@@ -0,0 +1,47 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <cstring>
+
+#include "config.h"
+#include "quirks.h"
+
+// the table is resolved at compile time
+static_assert(
+    stenc::find_quirks("IBM", "ULT3580-TD8", "Q3A2").nbes_blank_check);
+
+/**
+ * Check that patterns match exactly or by prefix, and that every drive
+ * model resolves to an entry of the quirks table.
+ */
+TEST_CASE("Match drive models against quirk patterns", "[quirks]")
+{
+  REQUIRE(stenc::matches_pattern("*", ""));
+  REQUIRE(stenc::matches_pattern("*", "HP"));
+  REQUIRE(stenc::matches_pattern("ULT3580*", "ULT3580-TD8"));
+  REQUIRE(stenc::matches_pattern("ULT3580*", "ULT3580"));
+  REQUIRE_FALSE(stenc::matches_pattern("ULT3580*", "ULT358"));
+  REQUIRE(stenc::matches_pattern("IBM", "IBM"));
+  REQUIRE_FALSE(stenc::matches_pattern("IBM", "IBMX"));
+  REQUIRE_FALSE(stenc::matches_pattern("IBM", ""));
+
+  const auto& quirks {stenc::find_quirks("HP", "Ultrium 6-SCSI", "J451")};
+  REQUIRE(quirks.nbes_blank_check);
+  REQUIRE_FALSE(quirks.no_nbes);
+  REQUIRE(quirks.sde_timeout == std::chrono::milliseconds {});
+}
+
+TEST_CASE("Look up quirks from inquiry data", "[quirks]")
+{
+  scsi::inquiry_data inq {};
+  std::memcpy(inq.vendor, "HP      ", sizeof(inq.vendor));
+  std::memcpy(inq.product_id, "Ultrium 6-SCSI  ", sizeof(inq.product_id));
+  std::memcpy(inq.product_rev, "J451", sizeof(inq.product_rev));
+
+  REQUIRE(&stenc::find_quirks(inq) ==
+          &stenc::find_quirks("HP", "Ultrium 6-SCSI", "J451"));
+}
@@ -0,0 +1,83 @@
+// SPDX-FileCopyrightText: 2022 stenc authors
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "rotation.h"
+
+using namespace std::literals::chrono_literals;
+
+struct fake_clock {
+  std::chrono::steady_clock::time_point start {};
+  std::chrono::steady_clock::time_point time {};
+
+  stenc::spread_clock clock()
+  {
+    return {[this] { return time; },
+            [this](std::chrono::steady_clock::time_point t) { time = t; }};
+  }
+  std::chrono::seconds elapsed() const
+  {
+    return std::chrono::duration_cast<std::chrono::seconds>(time - start);
+  }
+};
+
+/**
+ * Check that key changes are spread across the window, that busy drives
+ * are deferred until idle, and that drives staying busy are given up on.
+ */
+TEST_CASE("Spread key changes over a window", "[rotation]")
+{
+  fake_clock clock;
+  std::vector<std::pair<std::size_t, std::chrono::seconds>> changes;
+  std::vector<std::string> messages;
+
+  auto outcomes {stenc::spread_changes(
+      4u, {40s, 5s},
+      [&](std::size_t i) { return i == 1u && clock.elapsed() < 25s; },
+      [&](std::size_t i) {
+        changes.emplace_back(i, clock.elapsed());
+        return i == 2u ? stenc::change_outcome::unchanged
+                       : stenc::change_outcome::changed;
+      },
+      [&](const std::string& message) { messages.push_back(message); },
+      clock.clock())};
+
+  const std::vector<std::pair<std::size_t, std::chrono::seconds>> expected {
+      {0u, 0s}, {2u, 10s}, {3u, 10s}, {1u, 25s}};
+  REQUIRE(changes == expected);
+  REQUIRE(outcomes == std::vector<stenc::change_outcome> {
+                          stenc::change_outcome::changed,
+                          stenc::change_outcome::changed,
+                          stenc::change_outcome::unchanged,
+                          stenc::change_outcome::changed});
+  REQUIRE(messages.size() == 4u);
+  REQUIRE(messages.back() == "Key change progress: 3 changed, 1 already set, "
+                             "0 failed, 0 remaining of 4 drives");
+}
+
+TEST_CASE("Give up on drives that stay busy", "[rotation]")
+{
+  fake_clock clock;
+  std::vector<std::string> messages;
+
+  auto outcomes {stenc::spread_changes(
+      2u, {20s, 3s}, [](std::size_t i) { return i == 0u; },
+      [](std::size_t) { return stenc::change_outcome::failed; },
+      [&](const std::string& message) { messages.push_back(message); },
+      clock.clock())};
+
+  REQUIRE(outcomes == std::vector<stenc::change_outcome> {
+                          stenc::change_outcome::deferred,
+                          stenc::change_outcome::failed});
+  REQUIRE(clock.elapsed() == 20s);
+  REQUIRE(messages.back() == "Key change deferred on 1 drives that stayed "
+                             "busy");
+}
@@ -8,6 +8,8 @@
 #include "config.h"
 #include "scsiencrypt.h"
 
+#include <sstream>
+
 #include <arpa/inet.h>
 
 using namespace std::literals::string_literals;
@@ -413,3 +415,201 @@ TEST_CASE("Interpret data encryption capabilties page", "[scsi]")
   REQUIRE(ntohs(algo2.maximum_eedk_size) == 0u);
   REQUIRE(ntohl(algo2.security_algorithm_code) == 0x00010010u);
 }
+
+TEST_CASE("Encryption command in caller buffer", "[scsi]")
+{
+  const std::uint8_t key[] {0x00, 0x11, 0x22, 0x33};
+  const std::string key_name {"Hi"};
+  std::uint8_t buffer[64];
+
+  auto length {scsi::make_sde(buffer, sizeof(buffer), scsi::encrypt_mode::on,
+                              scsi::decrypt_mode::on, 1u, key, sizeof(key),
+                              key_name, scsi::kadf::ascii_key_name,
+                              scsi::sde_rdmc::algorithm_default, false)};
+  auto expected {scsi::make_sde(
+      scsi::encrypt_mode::on, scsi::decrypt_mode::on, 1u,
+      std::vector<std::uint8_t>(key, key + sizeof(key)), key_name,
+      scsi::kadf::ascii_key_name, scsi::sde_rdmc::algorithm_default, false)};
+  REQUIRE(length == sizeof(scsi::page_sde) + sizeof(key) + sizeof(scsi::kad) +
+                        key_name.size());
+  REQUIRE(std::memcmp(buffer, expected.get(), length) == 0);
+
+  REQUIRE_THROWS_AS(scsi::make_sde(buffer, 20u, scsi::encrypt_mode::on,
+                                   scsi::decrypt_mode::on, 1u, key,
+                                   sizeof(key), key_name,
+                                   scsi::kadf::ascii_key_name,
+                                   scsi::sde_rdmc::algorithm_default, false),
+                    std::length_error);
+}
+
+TEST_CASE("Encryption command with reservation flags", "[scsi]")
+{
+  std::uint8_t buffer[64];
+
+  scsi::make_sde(buffer, sizeof(buffer), scsi::encrypt_mode::off,
+                 scsi::decrypt_mode::off, 1u, nullptr, 0u, {},
+                 scsi::kadf::unspecified, scsi::sde_rdmc::algorithm_default,
+                 false, true, false);
+  REQUIRE(buffer[5] == 0x42); // CEEM, CKORP
+
+  scsi::make_sde(buffer, sizeof(buffer), scsi::encrypt_mode::off,
+                 scsi::decrypt_mode::off, 1u, nullptr, 0u, {},
+                 scsi::kadf::unspecified, scsi::sde_rdmc::algorithm_default,
+                 false, true, true);
+  REQUIRE(buffer[5] == 0x43); // CEEM, CKORP, CKORL
+}
+
+TEST_CASE("Encryption command with local scope", "[scsi]")
+{
+  std::uint8_t buffer[64];
+
+  scsi::make_sde(buffer, sizeof(buffer), scsi::encrypt_mode::off,
+                 scsi::decrypt_mode::off, 1u, nullptr, 0u, {},
+                 scsi::kadf::unspecified, scsi::sde_rdmc::algorithm_default,
+                 false, false, false, scsi::nexus_scope::local);
+  REQUIRE(buffer[4] == 0x20); // scope
+
+  const std::uint8_t des[] {
+      0x00, 0x20, 0x00, 0x14, 0x22, 0x02, 0x02, 0x01, 0x00, 0x00, 0x00, 0x01,
+      0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  };
+  REQUIRE(reinterpret_cast<const scsi::page_des&>(des).it_nexus_scope() ==
+          scsi::nexus_scope::local);
+}
+
+TEST_CASE("Interpret device identification VPD page", "[scsi]")
+{
+  const std::uint8_t page[] {
+      // clang-format off
+      0x01, 0x83, 0x00, 0x28, // header
+      // T10 vendor ID, logical unit
+      0x02, 0x01, 0x00, 0x0c,
+      'A', 'C', 'M', 'E', ' ', ' ', ' ', ' ', '1', '2', '3', ' ',
+      // NAA, target port
+      0x01, 0x93, 0x00, 0x08,
+      0x50, 0x00, 0xe1, 0x11, 0x56, 0x30, 0x40, 0x02,
+      // NAA, logical unit
+      0x01, 0x03, 0x00, 0x08,
+      0x50, 0x00, 0xe1, 0x11, 0x56, 0x30, 0x40, 0x01,
+      // clang-format on
+  };
+  REQUIRE(scsi::logical_unit_designator(page, sizeof(page)) ==
+          "naa.5000e11156304001"s);
+  // without the NAA designator, fall back to the T10 vendor ID
+  REQUIRE(scsi::logical_unit_designator(page, 28u) == "t10.ACME    123"s);
+  REQUIRE(scsi::logical_unit_designator(page, 4u).empty());
+}
+
+TEST_CASE("Device handle pool", "[scsi]")
+{
+  // commands fail on these devices, but only after the device was opened
+  scsi::set_session_capacity(2u);
+  REQUIRE_THROWS(scsi::get_inquiry("/dev/null"s));
+  REQUIRE_THROWS(scsi::get_inquiry("/dev/null"s));
+  REQUIRE_THROWS(scsi::get_inquiry("/dev/zero"s));
+  REQUIRE_THROWS(scsi::get_inquiry("/dev/full"s));
+  REQUIRE_THROWS(scsi::get_inquiry("/dev/zero"s));
+  REQUIRE_THROWS(scsi::get_inquiry("/dev/null"s));
+
+  auto stats {scsi::get_session_stats()};
+  REQUIRE(stats.hits == 2u);
+  REQUIRE(stats.misses == 4u);
+  REQUIRE(stats.evictions == 2u);
+  REQUIRE(stats.open == 2u);
+
+  scsi::close_session("/dev/null"s);
+  REQUIRE(scsi::get_session_stats().open == 1u);
+  scsi::set_session_capacity(0u);
+  REQUIRE(scsi::get_session_stats().open == 0u);
+}
+
+TEST_CASE("Interpret fixed format sense data", "[scsi]")
+{
+  const std::uint8_t buffer[] {
+      // clang-format off
+      0xf0, // valid, response code 70h
+      0x00, // obsolete
+      0x02, // sense key = NOT READY
+      0x00, 0x00, 0x01, 0x00, // information
+      0x0a, // additional sense length
+      0x00, 0x00, 0x00, 0x00, // command specific information
+      0x04, 0x07, // ASC, ASCQ
+      0x00, // field replaceable unit code
+      0x80, 0x40, 0x00, // SKSV, progress indication
+      // clang-format on
+  };
+
+  scsi::sense_view sense {buffer, sizeof(buffer)};
+  REQUIRE(sense.valid());
+  REQUIRE_FALSE(sense.descriptor_format());
+  REQUIRE_FALSE(sense.deferred());
+  REQUIRE(sense.sense_key() == scsi::sense_data::not_ready);
+  REQUIRE(sense.asc() == 0x04u);
+  REQUIRE(sense.ascq() == 0x07u);
+  REQUIRE(sense.information() == 0x100u);
+  REQUIRE(sense.progress() == 0x4000u);
+  REQUIRE(sense.size() == sizeof(buffer));
+
+  std::ostringstream oss;
+  scsi::print_sense_data(oss, sense);
+  REQUIRE(oss.str().find("Device not ready (0x02)") != std::string::npos);
+  REQUIRE(oss.str().find(" Progress:") != std::string::npos);
+}
+
+TEST_CASE("Interpret descriptor format sense data", "[scsi]")
+{
+  const std::uint8_t buffer[] {
+      // clang-format off
+      0x73, // response code 73h (deferred)
+      0x08, // sense key = BLANK CHECK
+      0x00, 0x05, // ASC, ASCQ
+      0x00, 0x00, 0x00, // reserved
+      0x14, // additional sense length
+      // sense key specific descriptor, no progress
+      0x02, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      // information descriptor
+      0x00, 0x0a, 0x80, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x12, 0x34,
+      // clang-format on
+  };
+
+  scsi::sense_view sense {buffer, sizeof(buffer)};
+  REQUIRE(sense.valid());
+  REQUIRE(sense.descriptor_format());
+  REQUIRE(sense.deferred());
+  REQUIRE(sense.sense_key() == scsi::sense_data::blank_check);
+  REQUIRE(sense.asc() == 0x00u);
+  REQUIRE(sense.ascq() == 0x05u);
+  REQUIRE(sense.information() == 0x1234u);
+  REQUIRE_FALSE(sense.progress());
+}
+
+TEST_CASE("Sense data is bounded by the buffer", "[scsi]")
+{
+  // additional sense length claims more than was transferred
+  const std::uint8_t buffer[] {
+      0x72, 0x02, 0x04, 0x01, 0x00, 0x00, 0x00, 0xff, 0x00, 0x0a, 0x80,
+  };
+
+  scsi::sense_view sense {buffer, sizeof(buffer)};
+  REQUIRE(sense.size() == sizeof(buffer));
+  REQUIRE(sense.sense_key() == scsi::sense_data::not_ready);
+  REQUIRE_FALSE(sense.information());
+  REQUIRE_FALSE(sense.progress());
+
+  scsi::sense_view empty {buffer, 0u};
+  REQUIRE_FALSE(empty.valid());
+  REQUIRE(empty.asc() == 0x00u);
+  REQUIRE_FALSE(empty.information());
+}
+
+TEST_CASE("Driver status falls back on non-st devices", "[scsi]")
+{
+  // the st driver does not answer, so TEST UNIT READY is sent instead
+  scsi::set_driver_status(true);
+  // switched off again even if the check fails, so later tests are unaffected
+  struct driver_status_reset {
+    ~driver_status_reset() { scsi::set_driver_status(false); }
+  } reset;
+  REQUIRE_THROWS_AS(scsi::is_device_ready("/dev/null"s), std::system_error);
+}